@@ -1,13 +1,12 @@
 #include "Archiver.hpp"
 #include "Formats.hpp"
 
-#include <spdlog/spdlog.h>
-
 #include <filesystem>
 #include <map>
 #include <memory>
 
 #include "util/Common.hpp"
+#include "util/Log.hpp"
 
 #if defined(unix) || defined(__unix__) || defined(__unix)
 std::string default_extension = ".tar.gz";
@@ -71,11 +70,11 @@ fs::path strip_archive_extension(const fs::path& path) {
   }
   stem_path = tmp_path;
 
-  spdlog::debug("Checking {} extensions", tmp_path);
+  XWIM_LOG_DEBUG("Checking {} extensions", tmp_path);
 
   while (tmp_path.has_extension()) {
     tmp_ext = tmp_path.extension() += tmp_ext;
-    spdlog::debug("Looking for {} in known extensions", tmp_ext);
+    XWIM_LOG_DEBUG("Looking for {} in known extensions", tmp_ext);
 
     Format format = find_extension_format(tmp_ext);
     tmp_longest_ext++;
@@ -86,15 +85,15 @@ fs::path strip_archive_extension(const fs::path& path) {
     }  // else: (Combined) extension not known, keep `longest_ext` as-is but try
        // longer extensions
 
-    spdlog::debug("Stemming {} to {}", tmp_path, tmp_path.stem());
+    XWIM_LOG_DEBUG("Stemming {} to {}", tmp_path, tmp_path.stem());
     tmp_path = tmp_path.stem();
   }
 
-  spdlog::debug("Found {} extensions", longest_ext);
+  XWIM_LOG_DEBUG("Found {} extensions", longest_ext);
   tmp_path = stem_path;
   for (int i = 0; i < longest_ext; i++) tmp_path = tmp_path.stem();
 
-  spdlog::debug("Stripped path is {} ", tmp_path);
+  XWIM_LOG_DEBUG("Stripped path is {} ", tmp_path);
   return tmp_path;
 }
 
@@ -108,18 +107,18 @@ std::filesystem::path default_archive(const std::filesystem::path& base) {
 bool can_handle_archive(const fs::path& path) {
   fs::path ext = archive_extension(path);
   if (format_extensions.find(ext.string()) != format_extensions.end()) {
-    spdlog::debug("Found {} in known formats", ext);
+    XWIM_LOG_DEBUG("Found {} in known formats", ext);
     return true;
   }
 
-  spdlog::debug("Could not find {} in known formats", ext);
+  XWIM_LOG_DEBUG("Could not find {} in known formats", ext);
   return false;
 }
 
 Format parse_format(const fs::path& path) {
-  spdlog::debug("Looking for path {}", path);
+  XWIM_LOG_DEBUG("Looking for path {}", path);
   fs::path ext = archive_extension(path);
-  spdlog::debug("Looking for ext {}", ext);
+  XWIM_LOG_DEBUG("Looking for ext {}", ext);
   Format format = find_extension_format(ext);
 
   if (format == Format::UNKNOWN) {
@@ -129,13 +128,14 @@ Format parse_format(const fs::path& path) {
   return format;
 }
 
-unique_ptr<Archiver> make_archiver(const string& archive_name) {
+unique_ptr<Archiver> make_archiver(const string& archive_name,
+                                   const Options& opts) {
   switch (parse_format(archive_name)) {
       case Format::TAR_GZIP:      case Format::TAR_BZIP2:
       case Format::TAR_COMPRESS:  case Format::TAR_LZIP:
       case Format::TAR_XZ:        case Format::TAR_ZSTD:
       case Format::ZIP:
-          return make_unique<LibArchiver>();
+          return make_unique<LibArchiver>(opts);
     default:
       throw XwimError{
           "Cannot construct archiver for {}. `extension_format` surjection "
@@ -5,30 +5,72 @@
 #include <filesystem>
 #include <map>
 #include <memory>
+#include <optional>
 #include <set>
+#include <vector>
 
 #include "util/Common.hpp"
+#include "util/Manifest.hpp"
 #include "Formats.hpp"
+#include "Xwim.hpp"
 
 namespace xwim {
 
 class Archiver {
+ protected:
+  Manifest* manifest = nullptr;
+  bool recursive = true;
+  std::optional<std::filesystem::path> flattened;
+
  public:
+  // Record checksums of all files extracted or compressed in `manifest`
+  void set_manifest(Manifest* manifest) { this->manifest = manifest; }
+
+  // Whether `compress` adds the content of directories or just the
+  // directories themselves
+  void set_recursive(bool recursive) { this->recursive = recursive; }
+
+  // An earlier extraction moved the content of the top-level folder `root`
+  // up into the output folder. `extract` writes entries below `root` there,
+  // too.
+  void set_flattened(const std::filesystem::path& root) {
+    this->flattened = root;
+  }
+
   virtual void compress(std::set<std::filesystem::path> ins,
                         std::filesystem::path archive_out) = 0;
 
   virtual void extract(std::filesystem::path archive_in,
                        std::filesystem::path out) = 0;
 
+  // Decode all entries of `archive_in` without writing anything. Throws
+  // `XwimError` if the archive is damaged.
+  virtual void test(std::filesystem::path archive_in) = 0;
+
+  // Write the entries of all `archives_in`, in order, to `archive_out`
+  // without extracting them
+  virtual void convert(std::vector<std::filesystem::path> archives_in,
+                       std::filesystem::path archive_out) = 0;
+
   virtual ~Archiver() = default;
 };
 
 class LibArchiver : public Archiver {
+ private:
+  Options opts;
+
  public:
+  explicit LibArchiver(const Options& opts = Options{}) : opts(opts){};
+
   void compress(std::set<std::filesystem::path> ins,
                 std::filesystem::path archive_out);
 
   void extract(std::filesystem::path archive_in, std::filesystem::path out);
+
+  void test(std::filesystem::path archive_in);
+
+  void convert(std::vector<std::filesystem::path> archives_in,
+               std::filesystem::path archive_out);
 };
 
 std::filesystem::path archive_extension(const std::filesystem::path& path);
@@ -38,6 +80,7 @@ std::filesystem::path default_archive(const std::filesystem::path& base);
 Format parse_format(const std::filesystem::path& path);
 bool can_handle_archive(const std::filesystem::path& path);
 
-std::unique_ptr<Archiver> make_archiver(const std::string& archive_name);
+std::unique_ptr<Archiver> make_archiver(const std::string& archive_name,
+                                        const Options& opts = Options{});
 
 }  // namespace xwim
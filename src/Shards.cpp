@@ -0,0 +1,143 @@
+#include "Shards.hpp"
+
+#include <fmt/core.h>
+
+#include <algorithm>
+#include <cerrno>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <functional>
+#include <queue>
+#include <string>
+#include <tuple>
+
+#include "Archiver.hpp"
+#include "util/Common.hpp"
+
+namespace xwim {
+namespace fs = std::filesystem;
+
+bool is_shard_list(const fs::path& path) {
+  return path.extension() == shard_list_extension;
+}
+
+fs::path shard_path(const fs::path& archive, unsigned index) {
+  fs::path shard = archive;
+  shard.replace_filename(
+      fmt::format("{}.{:03}{}", strip_archive_extension(archive).filename(),
+                  index, archive_extension(archive)));
+  return shard;
+}
+
+fs::path shard_list_path(const fs::path& archive) {
+  fs::path list = archive;
+  list += shard_list_extension;
+  return list;
+}
+
+// Add `path` and its parents up to and including `root` to `shard`
+static void add_with_parents(std::set<fs::path>& shard, const fs::path& path,
+                             const fs::path& root) {
+  for (fs::path p = path; p.native().size() >= root.native().size();
+       p = p.parent_path()) {
+    // Parents of a path already in the shard are in it, too
+    if (!shard.insert(p).second || p == root) break;
+  }
+}
+
+std::vector<std::set<fs::path>> plan_shards(const std::set<fs::path>& ins,
+                                            unsigned shards) {
+  struct File {
+    uintmax_t size;
+    fs::path path;
+    fs::path root;  // input `path` was found in
+  };
+  std::vector<File> files;
+  std::vector<File> empty_dirs;
+
+  for (fs::path in : ins) {
+    // `in/` is the folder `in`, the parents added stop there
+    if (!in.has_filename() && in.has_relative_path()) in = in.parent_path();
+
+    fs::file_status status = fs::symlink_status(in);
+    if (!fs::is_directory(status)) {
+      files.push_back({fs::is_regular_file(status) ? fs::file_size(in) : 0,
+                       in, in});
+      continue;
+    }
+
+    if (fs::is_empty(in)) empty_dirs.push_back({0, in, in});
+    for (const auto& e : fs::recursive_directory_iterator(in)) {
+      status = e.symlink_status();
+      if (!fs::is_directory(status)) {
+        files.push_back(
+            {fs::is_regular_file(status) ? e.file_size() : 0, e.path(), in});
+      } else if (fs::is_empty(e.path())) {
+        empty_dirs.push_back({0, e.path(), in});
+      }
+    }
+  }
+
+  shards = std::max<size_t>(1, std::min<size_t>(shards, files.size()));
+  std::vector<std::set<fs::path>> planned(shards);
+
+  // Largest first, ties by path so the plan is reproducible
+  std::sort(files.begin(), files.end(), [](const File& a, const File& b) {
+    return std::tie(b.size, a.path) < std::tie(a.size, b.path);
+  });
+
+  using Load = std::pair<uintmax_t, unsigned>;  // (bytes, shard)
+  std::priority_queue<Load, std::vector<Load>, std::greater<Load>> loads;
+  for (unsigned i = 0; i < shards; i++) loads.push({0, i});
+
+  for (const File& file : files) {
+    auto [load, shard] = loads.top();
+    loads.pop();
+    add_with_parents(planned[shard], file.path, file.root);
+    loads.push({load + file.size, shard});
+  }
+
+  for (const File& dir : empty_dirs) {
+    add_with_parents(planned[0], dir.path, dir.root);
+  }
+
+  return planned;
+}
+
+void write_shard_list(const fs::path& list,
+                      const std::vector<fs::path>& shards) {
+  std::FILE* file = std::fopen(list.c_str(), "w");
+  if (!file) {
+    throw XwimError{"Failed opening shard list {}. {}", list,
+                    std::strerror(errno)};
+  }
+
+  for (const fs::path& shard : shards) {
+    fmt::print(file, "{}\n", shard.filename());
+  }
+
+  bool failed = std::ferror(file) != 0;
+  failed |= std::fclose(file) != 0;
+  if (failed) throw XwimError{"Failed writing shard list {}", list};
+}
+
+std::vector<fs::path> read_shard_list(const fs::path& list) {
+  std::ifstream file{list};
+  if (!file) {
+    throw XwimError{"Failed opening shard list {}. {}", list,
+                    std::strerror(errno)};
+  }
+
+  std::vector<fs::path> shards;
+  for (std::string line; std::getline(file, line);) {
+    if (line.empty()) continue;
+    shards.push_back(list.parent_path() / line);
+  }
+
+  if (shards.empty()) throw XwimError{"Shard list {} is empty", list};
+  return shards;
+}
+
+}  // namespace xwim
@@ -0,0 +1,49 @@
+#pragma once
+
+#include <filesystem>
+#include <set>
+#include <vector>
+
+namespace xwim {
+
+/**
+ * Sharded archives.
+ *
+ * A sharded archive `out.tar.zst` consists of standalone archives
+ * `out.000.tar.zst`, `out.001.tar.zst`, ... and a shard list
+ * `out.tar.zst.shards` naming them, one per line, relative to the list.
+ */
+
+// Extension of shard lists
+inline constexpr const char* shard_list_extension = ".shards";
+
+bool is_shard_list(const std::filesystem::path& path);
+
+// Path of the `index`th shard of `archive`
+std::filesystem::path shard_path(const std::filesystem::path& archive,
+                                 unsigned index);
+
+// Path of the shard list of `archive`
+std::filesystem::path shard_list_path(const std::filesystem::path& archive);
+
+/**
+ * Partition everything below `ins` into at most `shards` sets of paths of
+ * roughly equal size.
+ *
+ * Files are assigned largest first to the currently smallest shard. Each
+ * shard also holds the directories leading to its files so it can be
+ * extracted on its own. Empty directories go to the first shard. The paths
+ * of a shard are meant to be archived without descending into directories.
+ */
+std::vector<std::set<std::filesystem::path>> plan_shards(
+    const std::set<std::filesystem::path>& ins, unsigned shards);
+
+// Throws `XwimError` if writing fails
+void write_shard_list(const std::filesystem::path& list,
+                      const std::vector<std::filesystem::path>& shards);
+
+// Shards named by `list`, throws `XwimError` if it cannot be read
+std::vector<std::filesystem::path> read_shard_list(
+    const std::filesystem::path& list);
+
+}  // namespace xwim
@@ -1,199 +1,448 @@
 #include "UserIntent.hpp"
 
-#include <spdlog/spdlog.h>
-
 #include <algorithm>
 #include <filesystem>
 
 #include "Archiver.hpp"
+#include "Shards.hpp"
+#include "archiver/Memory.hpp"
+#include "util/Budget.hpp"
+#include "util/Log.hpp"
+#include "util/Manifest.hpp"
+#include "util/Parallel.hpp"
+#include "util/Trace.hpp"
 
 namespace xwim {
-unique_ptr<UserIntent> make_compress_intent(const UserOpt &userOpt) {
-  if (userOpt.paths.size() == 1) {
+unique_ptr<UserIntent> make_compress_intent(const Options &opts) {
+  if (opts.paths.size() == 1) {
     return make_unique<CompressSingleIntent>(
-        CompressSingleIntent{*userOpt.paths.begin(), userOpt.out});
+        CompressSingleIntent{*opts.paths.begin(), opts.out, opts});
   }
 
-  if (!userOpt.out.has_value()) {
+  if (!opts.out.has_value()) {
     throw XwimError("Cannot guess output for multiple targets");
   }
 
   return make_unique<CompressManyIntent>(
-      CompressManyIntent{userOpt.paths, userOpt.out.value()});
+      CompressManyIntent{opts.paths, opts.out.value(), opts});
+}
+
+// Whether `p` can be extracted or tested, i.e. is an archive or a shard list
+static bool can_handle_input(const path &p) {
+  return can_handle_archive(p) || is_shard_list(p);
 }
 
-unique_ptr<UserIntent> make_extract_intent(const UserOpt &userOpt) {
-  for (const path &p : userOpt.paths) {
-    if (!can_handle_archive(p)) {
+unique_ptr<UserIntent> make_extract_intent(const Options &opts) {
+  for (const path &p : opts.paths) {
+    if (!can_handle_input(p)) {
       throw XwimError("Cannot extract path {}", p);
     }
   }
 
-  return make_unique<ExtractIntent>(ExtractIntent{userOpt.paths, userOpt.out});
+  return make_unique<ExtractIntent>(ExtractIntent{opts.paths, opts.out, opts});
 }
 
-unique_ptr<UserIntent> try_infer_compress_intent(const UserOpt &userOpt) {
-  if (!userOpt.out.has_value()) {
-    spdlog::debug("No <out> provided");
-    if (userOpt.paths.size() != 1) {
-      spdlog::debug(
+unique_ptr<UserIntent> make_test_intent(const Options &opts) {
+  for (const path &p : opts.paths) {
+    if (!can_handle_input(p)) {
+      throw XwimError("Cannot test path {}", p);
+    }
+  }
+
+  return make_unique<TestIntent>(TestIntent{opts.paths, opts});
+}
+
+unique_ptr<UserIntent> make_convert_intent(const Options &opts) {
+  for (const path &p : opts.paths) {
+    if (!can_handle_input(p)) {
+      throw XwimError("Cannot convert path {}", p);
+    }
+  }
+
+  if (!opts.out.has_value()) {
+    throw XwimError("Cannot guess output archive for conversion");
+  }
+  if (!can_handle_archive(opts.out.value())) {
+    throw XwimError("Unknown archive format {}", opts.out.value());
+  }
+
+  return make_unique<ConvertIntent>(
+      ConvertIntent{opts.paths, opts.out.value(), opts});
+}
+
+unique_ptr<UserIntent> try_infer_compress_intent(const Options &opts) {
+  if (!opts.out.has_value()) {
+    log::debug("No <out> provided");
+    if (opts.paths.size() != 1) {
+      log::debug(
           "Not a single-path compression. Cannot guess <out> for many-path "
           "compression");
       return nullptr;
     }
 
-    spdlog::debug("Only one <path> provided. Assume single-path compression.");
+    log::debug("Only one <path> provided. Assume single-path compression.");
     return make_unique<CompressSingleIntent>(
-        CompressSingleIntent{*userOpt.paths.begin(), userOpt.out});
+        CompressSingleIntent{*opts.paths.begin(), opts.out, opts});
   }
 
-  spdlog::debug("<out> provided: {}", userOpt.out.value());
-  if (can_handle_archive(userOpt.out.value())) {
-    spdlog::debug("{} given and a known archive format, assume compression",
-                  userOpt.out.value());
-    return make_compress_intent(userOpt);
+  log::debug("<out> provided: {}", opts.out.value());
+  if (can_handle_archive(opts.out.value())) {
+    log::debug("{} given and a known archive format, assume compression",
+                  opts.out.value());
+    return make_compress_intent(opts);
   }
 
-  spdlog::debug(
+  log::debug(
       "Cannot compress multiple paths without a user-provided output archive");
   return nullptr;
 }
 
-unique_ptr<UserIntent> try_infer_extract_intent(const UserOpt &userOpt) {
+unique_ptr<UserIntent> try_infer_extract_intent(const Options &opts) {
   bool can_extract_all =
-      std::all_of(userOpt.paths.begin(), userOpt.paths.end(),
-                  [](const path &path) { return can_handle_archive(path); });
+      std::all_of(opts.paths.begin(), opts.paths.end(),
+                  [](const path &path) { return can_handle_input(path); });
 
   if (!can_extract_all) {
-    spdlog::debug(
+    log::debug(
         "Cannot extract all provided <paths>. Assume this is not an "
         "extraction.");
-    for (const path &p : userOpt.paths) {
-      if (!can_handle_archive(p)) {
-        spdlog::debug("Cannot handle {}", p);
+    for (const path &p : opts.paths) {
+      if (!can_handle_input(p)) {
+        log::debug("Cannot handle {}", p);
       }
     }
 
     return nullptr;
   }
 
-  if (userOpt.out.has_value() && can_handle_archive(userOpt.out.value())) {
-    spdlog::debug(
+  if (opts.out.has_value() && can_handle_archive(opts.out.value())) {
+    log::debug(
         "Could extract all provided <paths>. But also {} looks like an "
         "archive. Ambiguous intent. Assume this is not an extraction.",
-        userOpt.out.value());
+        opts.out.value());
     return nullptr;
   }
 
-  spdlog::debug(
+  log::debug(
       "Could extract all provided <paths>. But also <out> looks like an "
       "archive. Ambiguous intent. Assume this is not an extraction.");
-  return make_extract_intent(userOpt);
+  return make_extract_intent(opts);
 }
 
-unique_ptr<UserIntent> make_intent(const UserOpt &userOpt) {
-  if (userOpt.wants_compress() && userOpt.wants_extract()) {
+unique_ptr<UserIntent> make_intent(const Options &opts) {
+  if (opts.wants_compress() && opts.wants_extract()) {
     throw XwimError("Cannot compress and extract simultaneously");
   }
-  if (userOpt.paths.empty()) {
+  if (opts.wants_test() && (opts.wants_compress() || opts.wants_extract())) {
+    throw XwimError("Cannot test and compress or extract simultaneously");
+  }
+  if (opts.wants_convert() &&
+      (opts.wants_compress() || opts.wants_extract() || opts.wants_test())) {
+    throw XwimError(
+        "Cannot convert and compress, extract or test simultaneously");
+  }
+  if (opts.paths.empty()) {
     throw XwimError("No input given...");
   }
 
   // explicitly specified intent
-  if (userOpt.wants_compress()) return make_compress_intent(userOpt);
-  if (userOpt.wants_extract()) return make_extract_intent(userOpt);
+  if (opts.wants_compress()) return make_compress_intent(opts);
+  if (opts.wants_extract()) return make_extract_intent(opts);
+  if (opts.wants_test()) return make_test_intent(opts);
+  if (opts.wants_convert()) return make_convert_intent(opts);
 
-  spdlog::info("Intent not explicitly provided, trying to infer intent");
+  log::info("Intent not explicitly provided, trying to infer intent");
 
-  if (auto intent = try_infer_extract_intent(userOpt)) {
-    spdlog::info("Extraction intent inferred");
+  if (auto intent = try_infer_extract_intent(opts)) {
+    log::info("Extraction intent inferred");
     return intent;
   }
-  spdlog::info("Cannot infer extraction intent");
+  log::info("Cannot infer extraction intent");
 
-  if (auto intent = try_infer_compress_intent(userOpt)) {
-    spdlog::info("Compression intent inferred");
+  if (auto intent = try_infer_compress_intent(opts)) {
+    log::info("Compression intent inferred");
     return intent;
   }
-  spdlog::info("Cannot infer compression intent");
+  log::info("Cannot infer compression intent");
 
   throw XwimError("Cannot guess intent");
 }
 
-void ExtractIntent::dwim_reparent(const path &out) {
+// Warn about a job that needs more than the whole `--memory-limit`, it runs
+// alone but still exceeds the limit
+static void check_job_memory(const path &p, uint64_t needed,
+                             const Options &opts) {
+  if (opts.memory_limit > 0 && needed > opts.memory_limit) {
+    log::warn("{} needs about {} MiB, more than --memory-limit allows", p,
+              needed >> 20);
+  }
+}
+
+// Manifest requested in `opts`, if any
+static unique_ptr<Manifest> make_manifest(const Options &opts) {
+  if (!opts.manifest.has_value()) return nullptr;
+  return make_unique<Manifest>(opts.manifest.value(), opts.manifest_hash);
+}
+
+bool ExtractIntent::dwim_reparent(const path &out) {
+  trace::Span span{"dwim_reparent", out};
+
   // move extraction if extraction resulted in only one entry and that entries
   // name is already the stripped archive name, i.e. reduce unnecessary nesting
   auto dit = std::filesystem::directory_iterator(out);
-  auto dit_path = dit->path();
 
   if (dit == std::filesystem::directory_iterator()) {
-    spdlog::debug(
+    log::debug(
         "Cannot flatten extraction folder: extraction folder is empty");
-    return;
+    return false;
   }
+  auto dit_path = dit->path();
 
   if (!is_directory(dit_path)) {
-    spdlog::debug("Cannot flatten extraction folder: {} is not a directory",
+    log::debug("Cannot flatten extraction folder: {} is not a directory",
                   dit_path);
-    return;
+    return false;
   }
 
   if (next(dit) != std::filesystem::directory_iterator()) {
-    spdlog::debug("Cannot flatten extraction folder: multiple items extracted");
-    return;
+    log::debug("Cannot flatten extraction folder: multiple items extracted");
+    return false;
   }
 
-  if (!std::filesystem::equivalent(dit_path.filename(), out.filename())) {
-    spdlog::debug(
+  if (dit_path.filename() != out.filename()) {
+    log::debug(
         "Cannot flatten extraction folder: archive entry differs from archive "
         "name [extraction folder: {}, archive entry: {}]",
         out.filename(), dit_path.filename());
-    return;
+    return false;
   }
 
-  spdlog::debug("Output folder [{}] is equivalent to archive entry [{}]", out,
+  log::debug("Output folder [{}] is equivalent to archive entry [{}]", out,
                 dit_path);
-  spdlog::info("Flattening extraction folder");
+  log::info("Flattening extraction folder");
 
   int i = rand_int(0, 100000);
   path tmp_out = path{out};
   tmp_out.concat(fmt::format(".xwim{}", i));
-  spdlog::debug("Move {} to {}", dit_path, tmp_out);
+  log::debug("Move {} to {}", dit_path, tmp_out);
   std::filesystem::rename(dit_path, tmp_out);
-  spdlog::debug("Remove parent path {}", out);
+  log::debug("Remove parent path {}", out);
   std::filesystem::remove(out);
-  spdlog::debug("Moving {} to {}", tmp_out, out);
+  log::debug("Moving {} to {}", tmp_out, out);
   std::filesystem::rename(tmp_out, out);
+  return true;
 }
 
+// Whether `out` holds an earlier extraction that an update writes into, as
+// laid out. Without a folder named like `out` in it, the earlier extraction
+// was flattened and `archiver` writes the root folder into `out` directly.
+static bool updates_existing(const Options &opts, const path &out,
+                             Archiver &archiver) {
+  if (!opts.update || !is_directory(out) || std::filesystem::is_empty(out)) {
+    return false;
+  }
+
+  if (!is_directory(out / out.filename())) {
+    archiver.set_flattened(out.filename());
+  }
+  return true;
+}
+
+// The folder is created by the archiver, once it checked the archive fits
 path ExtractIntent::out_path(const path &p) {
   if (!this->out.has_value()) {
     // not out path given, create from archive name
-    path out = std::filesystem::current_path() / strip_archive_extension(p);
-    create_directories(out);
-    return out;
+    return std::filesystem::current_path() / strip_archive_extension(p);
   }
 
   if (this->archives.size() == 1) {
     // out given and only one archive to extract, just extract into `out`
-    create_directories(this->out.value());
     return this->out.value();
   }
 
   // out given and multiple archives to extract, create subfolder
   // for each archive
-  create_directories(this->out.value());
   path out = this->out.value() / strip_archive_extension(p);
   return out;
 }
 
-void ExtractIntent::execute() {
+Result ExtractIntent::execute() {
+  trace::Span span{"ExtractIntent::execute"};
+  Result result;
+  unique_ptr<Manifest> manifest = make_manifest(this->opts);
+
   for (const path &p : this->archives) {
-    std::unique_ptr<Archiver> archiver = make_archiver(p);
+    if (is_shard_list(p)) {
+      // Shards are standalone archives of disjoint files, extract them into
+      // the same folder concurrently
+      vector<path> shards = read_shard_list(p);
+      path out = this->out_path(path{p}.replace_extension());
+      uint64_t lines = manifest ? manifest->end() : 0;
+      // Decided before any shard writes to `out`
+      vector<std::unique_ptr<Archiver>> archivers;
+      bool update = false;
+      for (const path &shard : shards) {
+        archivers.push_back(make_archiver(shard, this->opts));
+        archivers.back()->set_manifest(manifest.get());
+        update = updates_existing(this->opts, out, *archivers.back());
+      }
+      MemoryBudget budget{this->opts.memory_limit};
+      parallel_for(shards.size(), worker_count(this->opts.threads),
+                   [&](size_t i) {
+                     uint64_t needed = decoder_memory(shards[i], this->opts);
+                     check_job_memory(shards[i], needed, this->opts);
+                     Reservation reservation{budget, needed};
+                     archivers[i]->extract(shards[i], out);
+                   });
+      if (!update && this->dwim_reparent(out) && manifest) {
+        manifest->relocate(lines, out / out.filename(), out);
+      }
+      result.outputs.push_back(out);
+      continue;
+    }
+
+    check_job_memory(p, decoder_memory(p, this->opts), this->opts);
+    std::unique_ptr<Archiver> archiver = make_archiver(p, this->opts);
+    archiver->set_manifest(manifest.get());
     path out = this->out_path(p);
+    uint64_t lines = manifest ? manifest->end() : 0;
+    bool update = updates_existing(this->opts, out, *archiver);
     archiver->extract(p, out);
-    this->dwim_reparent(out);
+    // Files moved up, so do their manifest lines
+    if (!update && this->dwim_reparent(out) && manifest) {
+      manifest->relocate(lines, out / out.filename(), out);
+    }
+    result.outputs.push_back(out);
+  }
+
+  if (manifest) manifest->close();
+  return result;
+}
+
+Result TestIntent::execute() {
+  trace::Span span{"TestIntent::execute"};
+  vector<path> archives;
+  for (const path &p : this->archives) {
+    if (is_shard_list(p)) {
+      vector<path> shards = read_shard_list(p);
+      archives.insert(archives.end(), shards.begin(), shards.end());
+    } else {
+      archives.push_back(p);
+    }
+  }
+
+  Result result;
+  result.verified.resize(archives.size());
+
+  // Split the workers between archives, the rest goes to testing entries of
+  // a single archive concurrently where the format allows
+  unsigned workers = worker_count(this->opts.threads);
+  unsigned archive_workers = min<size_t>(workers, archives.size());
+  Options archive_opts = this->opts;
+  archive_opts.threads = max(1u, workers / max(1u, archive_workers));
+
+  // Zip archives are tested with one reader per worker
+  MemoryBudget budget{this->opts.memory_limit};
+  parallel_for(archives.size(), archive_workers, [&](size_t i) {
+    Verification &v = result.verified[i];
+    v.archive = archives[i];
+    try {
+      uint64_t needed = decoder_memory(archives[i], archive_opts);
+      if (parse_format(archives[i]) == Format::ZIP) {
+        needed *= archive_opts.threads;
+      }
+      check_job_memory(archives[i], needed, this->opts);
+      Reservation reservation{budget, needed};
+
+      trace::Span span{"test", archives[i]};
+      make_archiver(archives[i], archive_opts)->test(archives[i]);
+      log::debug("{} is intact", archives[i]);
+    } catch (std::exception &e) {
+      log::debug("{} is damaged. {}", archives[i], e.what());
+      v.error = e.what();
+    }
+  });
+
+  return result;
+}
+
+Result ConvertIntent::execute() {
+  trace::Span span{"ConvertIntent::execute"};
+  vector<path> archives;
+  for (const path &p : this->archives) {
+    if (is_shard_list(p)) {
+      vector<path> shards = read_shard_list(p);
+      archives.insert(archives.end(), shards.begin(), shards.end());
+    } else {
+      archives.push_back(p);
+    }
   }
+
+  for (const path &p : archives) {
+    std::error_code ec;
+    if (std::filesystem::equivalent(p, this->out, ec)) {
+      throw XwimError("Cannot convert {} into itself", p);
+    }
+  }
+
+  // Inputs are decoded one after the other
+  uint64_t needed = 0;
+  for (const path &p : archives) {
+    needed = max(needed, decoder_memory(p, this->opts));
+  }
+  // The pipe, and an entry of unknown size held back before it
+  needed += encoder_memory(parse_format(this->out), this->opts) +
+            2 * buffer_sizes(this->opts).convert_pipe;
+  check_job_memory(this->out, needed, this->opts);
+
+  unique_ptr<Manifest> manifest = make_manifest(this->opts);
+  unique_ptr<Archiver> archiver = make_archiver(this->out, this->opts);
+  archiver->set_manifest(manifest.get());
+  archiver->convert(archives, this->out);
+
+  if (manifest) manifest->close();
+
+  Result result;
+  result.outputs.push_back(this->out);
+  return result;
+}
+
+// Compress `ins` into `opts.shards` standalone archives named after `out`,
+// concurrently, and list them in the shard list of `out`
+static Result compress_shards(const set<path> &ins, const path &out,
+                              const Options &opts, Manifest *manifest) {
+  vector<set<path>> plan = plan_shards(ins, opts.shards);
+  vector<path> shards;
+  for (unsigned i = 0; i < plan.size(); i++) {
+    shards.push_back(shard_path(out, i));
+  }
+  log::info("Compressing into {} shards", shards.size());
+
+  // Workers left over go to compressing a single shard concurrently where the
+  // format allows
+  unsigned workers = worker_count(opts.threads);
+  Options shard_opts = opts;
+  shard_opts.threads = max<size_t>(1, workers / shards.size());
+
+  MemoryBudget budget{opts.memory_limit};
+  uint64_t needed = encoder_memory(parse_format(out), shard_opts);
+  check_job_memory(out, needed, opts);
+
+  parallel_for(shards.size(), workers, [&](size_t i) {
+    Reservation reservation{budget, needed};
+    unique_ptr<Archiver> archiver = make_archiver(shards[i], shard_opts);
+    archiver->set_manifest(manifest);
+    archiver->set_recursive(false);
+    archiver->compress(plan[i], shards[i]);
+  });
+
+  path list = shard_list_path(out);
+  write_shard_list(list, shards);
+
+  Result result;
+  result.outputs = shards;
+  result.outputs.push_back(list);
+  return result;
 }
 
 path CompressSingleIntent::out_path() {
@@ -208,19 +457,46 @@ path CompressSingleIntent::out_path() {
   return default_archive(strip_archive_extension(this->in).stem());
 }
 
-void CompressSingleIntent::execute() {
+Result CompressSingleIntent::execute() {
+  trace::Span span{"CompressSingleIntent::execute"};
   path out = this->out_path();
-  unique_ptr<Archiver> archiver = make_archiver(out);
+  unique_ptr<Manifest> manifest = make_manifest(this->opts);
   set<path> ins{this->in};
-  archiver->compress(ins, out);
+
+  Result result;
+  if (this->opts.shards > 1) {
+    result = compress_shards(ins, out, this->opts, manifest.get());
+  } else {
+    unique_ptr<Archiver> archiver = make_archiver(out, this->opts);
+    archiver->set_manifest(manifest.get());
+    archiver->compress(ins, out);
+    result.outputs.push_back(out);
+  }
+
+  if (manifest) manifest->close();
+  return result;
 };
 
-void CompressManyIntent::execute() {
+Result CompressManyIntent::execute() {
+  trace::Span span{"CompressManyIntent::execute"};
   if (!can_handle_archive(this->out)) {
     throw XwimError("Unknown archive format {}", this->out);
   }
 
-  unique_ptr<Archiver> archiver = make_archiver(this->out);
-  archiver->compress(this->in_paths, this->out);
+  unique_ptr<Manifest> manifest = make_manifest(this->opts);
+
+  Result result;
+  if (this->opts.shards > 1) {
+    result = compress_shards(this->in_paths, this->out, this->opts,
+                             manifest.get());
+  } else {
+    unique_ptr<Archiver> archiver = make_archiver(this->out, this->opts);
+    archiver->set_manifest(manifest.get());
+    archiver->compress(this->in_paths, this->out);
+    result.outputs.push_back(this->out);
+  }
+
+  if (manifest) manifest->close();
+  return result;
 }
 }  // namespace xwim
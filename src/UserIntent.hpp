@@ -4,7 +4,7 @@
 #include <set>
 
 #include "util/Common.hpp"
-#include "UserOpt.hpp"
+#include "Xwim.hpp"
 
 namespace xwim {
 using namespace std;
@@ -12,12 +12,12 @@ using std::filesystem::path;
 
 class UserIntent {
 public:
-    virtual void execute() = 0;
+    virtual Result execute() = 0;
     virtual ~UserIntent() = default;
 };
 
 /* Factory method to construct a UserIntent which implements `execute()` */
-unique_ptr<UserIntent> make_intent(const UserOpt& userOpt);
+unique_ptr<UserIntent> make_intent(const Options& opts);
 
 /**
 * Extraction intent
@@ -29,15 +29,59 @@ class ExtractIntent: public UserIntent {
 private:
     set<path> archives;
     optional<path> out;
+    Options opts;
 
-    void dwim_reparent(const path& out);
+    // Returns whether the content of `out` was moved up one level
+    bool dwim_reparent(const path& out);
     path out_path(const path& p);
 
    public:
-    ExtractIntent(set<path> archives, optional<path> out): archives(archives), out(out) {};
+    ExtractIntent(set<path> archives, optional<path> out, Options opts = Options{})
+        : archives(archives), out(out), opts(opts) {};
     ~ExtractIntent() override = default;
 
-    void execute() override;
+    Result execute() override;
+};
+
+/**
+* Test intent
+*
+* Verifies one or multiple archives by decoding all entries, including checksums, without writing anything to the
+* file system. Archives are tested concurrently. Entries of zip archives are additionally tested concurrently.
+*
+* A damaged archive does not fail the intent, it is reported in `Result::verified`.
+*/
+class TestIntent: public UserIntent {
+private:
+    set<path> archives;
+    Options opts;
+
+public:
+    TestIntent(set<path> archives, Options opts = Options{}): archives(archives), opts(opts) {};
+    ~TestIntent() override = default;
+
+    Result execute() override;
+};
+
+/**
+* Convert intent
+*
+* Transcodes one or multiple archives into the single `out` archive, e.g. a `.zip` into a `.tar.zst`. Entries are
+* streamed from the input archives straight into `out`, nothing is extracted to the file system. Entries of multiple
+* archives (or the shards of a shard list) are merged into `out` in the given order.
+*/
+class ConvertIntent: public UserIntent {
+private:
+    set<path> archives;
+    path out;
+    Options opts;
+
+public:
+    ConvertIntent(set<path> archives, path out, Options opts = Options{})
+        : archives(archives), out(out), opts(opts) {};
+    ~ConvertIntent() override = default;
+
+    Result execute() override;
 };
 
 /**
@@ -59,14 +103,16 @@ class CompressSingleIntent : public UserIntent {
 private:
     path in;
     optional<path> out;
+    Options opts;
 
     path out_path();
 
 public:
-    CompressSingleIntent(path in, optional<path> out) : UserIntent(), in(in), out(out) {};
+    CompressSingleIntent(path in, optional<path> out, Options opts = Options{})
+        : UserIntent(), in(in), out(out), opts(opts) {};
     ~CompressSingleIntent() override = default;
 
-    void execute() override;
+    Result execute() override;
 };
 
 /**
@@ -82,12 +128,14 @@ class CompressManyIntent: public UserIntent {
 private:
     set<path> in_paths;
     path out;
+    Options opts;
 
 public:
-    CompressManyIntent(set<path> in_paths, path out): UserIntent(), in_paths(in_paths), out(out) {};
+    CompressManyIntent(set<path> in_paths, path out, Options opts = Options{})
+        : UserIntent(), in_paths(in_paths), out(out), opts(opts) {};
     ~CompressManyIntent() override = default;
 
-    void execute() override;
+    Result execute() override;
 };
 
 }  // namespace xwim
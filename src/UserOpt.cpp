@@ -2,6 +2,13 @@
 
 #include <tclap/CmdLine.h>
 
+#include <cctype>
+#include <cstdint>
+#include <istream>
+#include <map>
+#include <string>
+#include <vector>
+
 template <>
 struct TCLAP::ArgTraits<std::filesystem::path> {
   // We use `operator=` here for path construction
@@ -10,6 +17,30 @@ struct TCLAP::ArgTraits<std::filesystem::path> {
   typedef StringLike ValueCategory;
 };
 
+// A number of bytes with an optional binary unit, e.g. `512M` or `2GiB`
+struct ByteSize {
+  uint64_t bytes = 0;
+};
+
+static std::istream& operator>>(std::istream& is, ByteSize& size) {
+  is >> size.bytes;
+  if (!is || is.eof()) return is;
+
+  std::string unit;
+  is >> unit;
+  const std::string units = "KMGT";
+  size_t exponent = unit.empty() ? std::string::npos
+                                 : units.find(std::toupper(unit[0]));
+  if (exponent != std::string::npos) {
+    size.bytes <<= 10 * (exponent + 1);
+    unit.erase(0, 1);
+    if (unit == "i" || unit == "iB") unit.clear();
+  }
+  if (!unit.empty() && unit != "B") is.setstate(std::ios::failbit);
+
+  return is;
+}
+
 namespace xwim {
 UserOpt::UserOpt(int argc, char** argv) {
   // clang-format off
@@ -22,12 +53,57 @@ UserOpt::UserOpt(int argc, char** argv) {
   TCLAP::SwitchArg arg_extract
     {"x", "extract", "Extract <file>", cmd, false};
 
+  TCLAP::SwitchArg arg_test
+    {"t", "test", "Test integrity of <files> without extracting", cmd, false};
+
+  TCLAP::SwitchArg arg_convert
+    {"", "convert", "Convert <files> to the archive format of <out> without extracting them", cmd, false};
+
   TCLAP::SwitchArg arg_noninteractive
     {"i", "non-interactive", "Non-interactive, fail on ambiguity", cmd, false};
 
   TCLAP::ValueArg<fs::path> arg_outfile
     {"o", "out", "Out <file-or-path>", false, fs::path{}, "A path on the filesystem", cmd};
 
+  std::vector<std::string> orderings{"disk", "inode", "type", "lexical"};
+  TCLAP::ValuesConstraint<std::string> ordering_constraint{orderings};
+  TCLAP::ValueArg<std::string> arg_ordering
+    {"", "order", "Order of archive entries when compressing", false, "disk", &ordering_constraint, cmd};
+
+  TCLAP::ValueArg<unsigned> arg_threads
+    {"j", "threads", "Worker threads, 0 for one per core", false, 0, "A number", cmd};
+
+  TCLAP::ValueArg<ByteSize> arg_memory_limit
+    {"", "memory-limit", "Memory archive jobs may take together, e.g. 512M or 2G; jobs are delayed and buffers shrunk to fit", false, ByteSize{}, "A size", cmd};
+
+  TCLAP::ValueArg<unsigned> arg_shards
+    {"", "shards", "Split the archive into <n> archives of similar size, built concurrently", false, 1, "A number", cmd};
+
+  TCLAP::ValueArg<fs::path> arg_manifest
+    {"", "manifest", "Write checksums of all files to <file>", false, fs::path{}, "A path on the filesystem", cmd};
+
+  std::vector<std::string> hashes{"xxh3", "sha256"};
+  TCLAP::ValuesConstraint<std::string> hash_constraint{hashes};
+  TCLAP::ValueArg<std::string> arg_manifest_hash
+    {"", "manifest-hash", "Hash for --manifest", false, "xxh3", &hash_constraint, cmd};
+
+  TCLAP::SwitchArg arg_resume
+    {"", "resume", "Continue an interrupted extraction", cmd, false};
+
+  TCLAP::SwitchArg arg_update
+    {"u", "update", "Only rewrite files that changed (size or modification time)", cmd, false};
+
+  TCLAP::SwitchArg arg_update_content
+    {"", "update-content", "Like --update, but compare the content of files that differ in modification time only", cmd, false};
+
+  std::vector<std::string> dedups{"reflink", "hardlink"};
+  TCLAP::ValuesConstraint<std::string> dedup_constraint{dedups};
+  TCLAP::ValueArg<std::string> arg_dedup
+    {"", "dedup", "Store duplicate files as reflinks (or hardlinks) of the first copy when extracting", false, "reflink", &dedup_constraint, cmd};
+
+  TCLAP::ValueArg<fs::path> arg_trace
+    {"", "trace", "Write a timeline of the run to <file> (Chrome trace-event format)", false, fs::path{}, "A path on the filesystem", cmd};
+
   TCLAP::MultiSwitchArg arg_verbose
     {"v", "verbose", "Verbosity level", cmd, 0};
 
@@ -39,8 +115,33 @@ UserOpt::UserOpt(int argc, char** argv) {
 
   if (arg_compress.isSet()) this->compress = arg_compress.getValue();
   if (arg_extract.isSet()) this->extract = arg_extract.getValue();
+  if (arg_test.isSet()) this->test = arg_test.getValue();
+  if (arg_convert.isSet()) this->convert = arg_convert.getValue();
   if (arg_outfile.isSet()) this->out = arg_outfile.getValue();
 
+  const std::map<std::string, Ordering> ordering_names{
+      {"disk", Ordering::DISK},
+      {"inode", Ordering::INODE},
+      {"type", Ordering::TYPE},
+      {"lexical", Ordering::LEXICAL}};
+  this->ordering = ordering_names.at(arg_ordering.getValue());
+  this->threads = arg_threads.getValue();
+  this->shards = arg_shards.getValue();
+  this->memory_limit = arg_memory_limit.getValue().bytes;
+
+  if (arg_manifest.isSet()) this->manifest = arg_manifest.getValue();
+  this->manifest_hash = arg_manifest_hash.getValue() == "sha256"
+                            ? HashAlgorithm::SHA256
+                            : HashAlgorithm::XXH3;
+  this->resume = arg_resume.getValue();
+  this->update_content = arg_update_content.getValue();
+  this->update = arg_update.getValue() || this->update_content;
+  if (arg_dedup.isSet()) {
+    this->dedup = arg_dedup.getValue() == "hardlink" ? Dedup::HARDLINK
+                                                     : Dedup::REFLINK;
+  }
+  if (arg_trace.isSet()) this->trace = arg_trace.getValue();
+
   this->verbosity = arg_verbose.getValue();
   this->interactive = !arg_noninteractive.getValue();
 
@@ -0,0 +1,37 @@
+#include "Xwim.hpp"
+
+#include <exception>
+#include <memory>
+
+#include "UserIntent.hpp"
+#include "util/Log.hpp"
+#include "util/Trace.hpp"
+
+namespace xwim {
+
+Result run(const Options& options) {
+  if (!options.trace.has_value()) {
+    return make_intent(options)->execute();
+  }
+
+  // Spans of this run only, concurrent runs record their own
+  trace::Recorder recorder;
+  trace::Attach attach{&recorder};
+  Result result;
+  try {
+    result = make_intent(options)->execute();
+  } catch (...) {
+    // Write the trace of failed runs too, they are the interesting ones. A
+    // failure to do so must not hide the original error.
+    try {
+      recorder.write(options.trace.value());
+    } catch (const std::exception& e) {
+      log::warn("{}", e.what());
+    }
+    throw;
+  }
+  recorder.write(options.trace.value());
+  return result;
+}
+
+}  // namespace xwim
@@ -0,0 +1,135 @@
+#pragma once
+
+#include <cstdint>
+#include <filesystem>
+#include <optional>
+#include <set>
+#include <string>
+#include <vector>
+
+namespace xwim {
+
+/**
+ * Order in which entries are written when compressing.
+ */
+enum class Ordering {
+  DISK,     // as returned by walking the file system (fastest to start)
+  INODE,    // by physical extent (FIEMAP) or inode, reduces seeks on reads
+  TYPE,     // clustered by extension and size, improves compression ratio
+  LEXICAL,  // by path name, reproducible across file systems
+};
+
+/**
+ * Content hash for manifests.
+ */
+enum class HashAlgorithm {
+  XXH3,    // XXH3 128 bit, fast
+  SHA256,  // requires libcrypto
+};
+
+/**
+ * How files identical to a file extracted before are stored.
+ */
+enum class Dedup {
+  NONE,      // write every file
+  REFLINK,   // share the data copy-on-write (btrfs, xfs), else write a copy
+  HARDLINK,  // hardlink if mode and modification time match, else REFLINK
+};
+
+/**
+ * Options for a single xwim run.
+ *
+ * This is what `UserOpt` parses from the command line. Embedders fill it in
+ * directly and hand it to `run` instead of going through `argc`/`argv`.
+ */
+struct Options {
+  std::optional<bool> compress;
+  std::optional<bool> extract;
+  std::optional<bool> test;
+  // Transcode archives into the `out` archive without touching the disk
+  std::optional<bool> convert;
+  bool interactive = true;
+  std::optional<std::filesystem::path> out;
+  std::set<std::filesystem::path> paths;
+  Ordering ordering = Ordering::DISK;
+  unsigned threads = 0;  // 0: one per core
+  // Bytes of memory concurrent archive jobs, their decoders, encoders and
+  // buffers may take together, 0 for no limit
+  uint64_t memory_limit = 0;
+  // Split the archive into this many standalone archives when compressing
+  unsigned shards = 1;
+  // Write checksums of all files extracted or compressed to this file
+  std::optional<std::filesystem::path> manifest;
+  HashAlgorithm manifest_hash = HashAlgorithm::XXH3;
+  // Continue an interrupted extraction, keep files it finished
+  bool resume = false;
+  // Only rewrite files whose size or modification time differ from the
+  // archive, replacing them atomically
+  bool update = false;
+  // With `update`, compare the data of files that differ in modification time
+  // only and keep them if identical
+  bool update_content = false;
+  // Store duplicate files of an extraction as links to the first copy
+  Dedup dedup = Dedup::NONE;
+  // Write a timeline of the run in Chrome trace-event format to this file
+  std::optional<std::filesystem::path> trace;
+
+  bool wants_compress() const {
+    return this->compress.has_value() && this->compress.value();
+  }
+
+  bool wants_extract() const {
+    return this->extract.has_value() && this->extract.value();
+  }
+
+  bool wants_test() const {
+    return this->test.has_value() && this->test.value();
+  }
+
+  bool wants_convert() const {
+    return this->convert.has_value() && this->convert.value();
+  }
+};
+
+/**
+ * Outcome of testing a single archive.
+ */
+struct Verification {
+  std::filesystem::path archive;
+  std::optional<std::string> error;  // empty if the archive is intact
+
+  bool ok() const { return !this->error.has_value(); }
+};
+
+/**
+ * Outcome of a successful run.
+ *
+ * Failures are reported by throwing `XwimError`. Damaged archives found by
+ * testing are not failures of the run, they are reported in `verified`.
+ */
+struct Result {
+  // Archives written or folders extracted into
+  std::vector<std::filesystem::path> outputs;
+  // Archives tested, in the order given
+  std::vector<Verification> verified;
+
+  bool ok() const {
+    for (const auto& v : this->verified) {
+      if (!v.ok()) return false;
+    }
+    return true;
+  }
+};
+
+/**
+ * Infer the intent from `options` and execute it.
+ *
+ * Does not touch the process-wide working directory or log configuration.
+ * Library logging goes to `xwim::log::logger()` which discards everything
+ * until a logger is installed with `xwim::log::set_logger`.
+ *
+ * @throws XwimError if the intent cannot be inferred or executing it fails
+ */
+Result run(const Options& options);
+
+}  // namespace xwim
@@ -0,0 +1,228 @@
+#include "GzipReader.hpp"
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#ifdef XWIM_HAVE_LIBDEFLATE
+#include <libdeflate.h>
+#endif
+
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+#include <memory>
+
+#include "../util/Common.hpp"
+#include "../util/Log.hpp"
+
+namespace xwim {
+using namespace std;
+namespace fs = std::filesystem;
+
+// Buffers of the zlib path
+static constexpr size_t buffer_size = 1 << 17;
+
+GzipReader::GzipReader(const fs::path& path, size_t whole_limit)
+    : whole_limit(whole_limit), zs{}, in(buffer_size), out(buffer_size) {
+  this->fd = ::open(path.c_str(), O_RDONLY | O_CLOEXEC);
+  if (this->fd < 0) {
+    throw XwimError{"Failed opening {}. {}", path, strerror(errno)};
+  }
+
+  // 16: expect a gzip header and check the trailer
+  if (inflateInit2(&this->zs, 16 + MAX_WBITS) != Z_OK) {
+    ::close(this->fd);
+    throw XwimError{"Failed initializing zlib for {}", path};
+  }
+}
+
+GzipReader::~GzipReader() {
+  inflateEnd(&this->zs);
+  ::close(this->fd);
+}
+
+bool GzipReader::accelerated() {
+#ifdef XWIM_HAVE_LIBDEFLATE
+  return true;
+#else
+  return false;
+#endif
+}
+
+// Decompressed size of the last member modulo 2^32 from the trailer of the
+// gzip data `tail`
+static uint32_t trailer_size(const unsigned char* tail) {
+  return tail[0] | tail[1] << 8 | tail[2] << 16 | uint32_t{tail[3]} << 24;
+}
+
+// Buffers and state of the zlib path
+static constexpr uint64_t streaming_memory = 2 * buffer_size + (64 << 10);
+
+// Decompressed size of the gzip file `fd` if it is decompressed in one go
+// with `whole_limit`, 0 if it is streamed
+static uint64_t whole_size(int fd, size_t whole_limit) {
+  struct stat st;
+  unsigned char tail[4];
+  if (fstat(fd, &st) != 0 || !S_ISREG(st.st_mode) || st.st_size < 18 ||
+      pread(fd, tail, 4, st.st_size - 4) != 4) {
+    return 0;
+  }
+
+  // Deflate adds 5 bytes per 64 KiB stored block at most. Data larger than
+  // that (plus room for header fields) is more than a single member of ISIZE
+  // bytes, which libdeflate would decompress only partly.
+  uint64_t isize = trailer_size(tail);
+  uint64_t data = st.st_size - 18;
+  if (isize == 0 || isize > whole_limit ||
+      data > isize + 5 * (isize / 65535 + 1) + (4 << 10)) {
+    return 0;
+  }
+  return isize;
+}
+
+uint64_t GzipReader::memory(const fs::path& path, size_t whole_limit) {
+  if (!accelerated()) return streaming_memory;
+
+  int fd = ::open(path.c_str(), O_RDONLY | O_CLOEXEC);
+  if (fd < 0) return streaming_memory;
+  uint64_t whole = whole_size(fd, whole_limit);
+  ::close(fd);
+
+  // The output is allocated next to the buffers of the zlib path
+  return whole + streaming_memory;
+}
+
+#ifdef XWIM_HAVE_LIBDEFLATE
+// Decompress the stream into `out` with libdeflate. Returns false if it is
+// not a single member of the size its trailer declares, or does not fit
+// `whole_limit`; the caller streams it through zlib then.
+bool GzipReader::inflate_whole() {
+  uint64_t isize = whole_size(this->fd, this->whole_limit);
+  struct stat st;
+  if (isize == 0 || fstat(this->fd, &st) != 0) return false;
+
+  // Mapped, the file offset stays at the start for zlib
+  size_t size = st.st_size;
+  void* map = mmap(nullptr, size, PROT_READ, MAP_PRIVATE, this->fd, 0);
+  if (map == MAP_FAILED) return false;
+  madvise(map, size, MADV_SEQUENTIAL);
+
+  unique_ptr<libdeflate_decompressor, void (*)(libdeflate_decompressor*)>
+      decompressor{libdeflate_alloc_decompressor(),
+                   libdeflate_free_decompressor};
+  vector<unsigned char> out(isize);
+  size_t in_used = 0;
+  size_t out_used = 0;
+  libdeflate_result r = LIBDEFLATE_BAD_DATA;
+  if (decompressor) {
+    r = libdeflate_gzip_decompress_ex(decompressor.get(), map, size,
+                                      out.data(), out.size(), &in_used,
+                                      &out_used);
+  }
+  munmap(map, size);
+
+  // Further members, padding or a wrapped ISIZE are left to zlib
+  if (r != LIBDEFLATE_SUCCESS || in_used != size || out_used != isize) {
+    return false;
+  }
+
+  this->out.swap(out);
+  return true;
+}
+#endif
+
+// Decompress the next chunk into `out`. Returns the number of bytes
+// produced, 0 at the end of the stream or -1 on error.
+ssize_t GzipReader::fill() {
+  if (this->decoded) {
+    // Hand out the whole stream once
+    if (this->in_eof) return 0;
+    this->in_eof = true;
+    return this->out.size();
+  }
+
+  this->zs.next_out = this->out.data();
+  this->zs.avail_out = this->out.size();
+
+  while (this->zs.avail_out == this->out.size()) {
+    if (this->zs.avail_in == 0 && !this->in_eof) {
+      ssize_t n = ::read(this->fd, this->in.data(), this->in.size());
+      if (n < 0) {
+        this->error = fmt::format("Failed reading gzip stream. {}",
+                                  strerror(errno));
+        return -1;
+      }
+      this->in_eof = n == 0;
+      this->zs.next_in = this->in.data();
+      this->zs.avail_in = n;
+    }
+
+    if (!this->in_member) {
+      // gzip tolerates zero padding after the last member
+      while (this->zs.avail_in > 0 && *this->zs.next_in == 0) {
+        this->zs.next_in++;
+        this->zs.avail_in--;
+      }
+      if (this->zs.avail_in == 0) {
+        if (this->in_eof) return 0;
+        continue;
+      }
+      this->in_member = true;
+    }
+
+    int r = inflate(&this->zs, Z_NO_FLUSH);
+    if (r == Z_STREAM_END) {
+      this->in_member = false;
+      inflateReset(&this->zs);
+    } else if (r == Z_BUF_ERROR && this->zs.avail_in == 0 && this->in_eof) {
+      this->error = "Truncated gzip stream";
+      return -1;
+    } else if (r != Z_OK && r != Z_BUF_ERROR) {
+      this->error = fmt::format("Corrupt gzip stream. {}",
+                                this->zs.msg ? this->zs.msg : "unknown error");
+      return -1;
+    }
+  }
+
+  return this->out.size() - this->zs.avail_out;
+}
+
+la_ssize_t GzipReader::read_cb(archive* a, void* self, const void** buff) {
+  GzipReader* gz = static_cast<GzipReader*>(self);
+  ssize_t n = gz->fill();
+  if (n < 0) {
+    archive_set_error(a, EIO, "%s", gz->error.c_str());
+    return ARCHIVE_FATAL;
+  }
+
+  *buff = gz->out.data();
+  return n;
+}
+
+void GzipReader::open(archive* reader) {
+#ifdef XWIM_HAVE_LIBDEFLATE
+  this->decoded = this->inflate_whole();
+  if (this->decoded) {
+    XWIM_LOG_DEBUG("Inflated {} bytes with libdeflate", this->out.size());
+  }
+#endif
+
+  int r = archive_read_open(reader, this, nullptr, GzipReader::read_cb,
+                            nullptr);
+  if (r != ARCHIVE_OK) {
+    throw XwimError{"Failed opening gzip stream. {}",
+                    archive_error_string(reader)};
+  }
+}
+
+void GzipReader::drain() {
+  ssize_t n;
+  while ((n = this->fill()) > 0) {
+  }
+
+  if (n < 0) throw XwimError{"{}", this->error};
+}
+
+}  // namespace xwim
@@ -0,0 +1,72 @@
+#pragma once
+
+#include <archive.h>
+#include <zlib.h>
+
+#include <cstdint>
+#include <filesystem>
+#include <string>
+#include <vector>
+
+namespace xwim {
+
+/**
+ * Feeds a gzip file to a libarchive reader, decompressed with zlib.
+ *
+ * libarchive's gzip filter does not check the CRC32 and size trailer of gzip
+ * members and stops reading once the tar end marker is found. `GzipReader`
+ * verifies every member, including the ones after the tar end marker when
+ * calling `drain`.
+ *
+ * If xwim is built with libdeflate, a stream whose decompressed size, as
+ * declared by its ISIZE trailer, fits into `whole_limit` is decompressed in
+ * one go with libdeflate instead, which picks SIMD code paths for the CPU at
+ * runtime. The compressed file is mapped, only the output takes memory.
+ * ISIZE holds the size of the last member only: a stream libdeflate cannot
+ * decompress into exactly that many bytes, e.g. one of several members, or
+ * that it rejects, is streamed through zlib from the start. At most ISIZE
+ * bytes are decompressed twice then, and errors are reported the same way.
+ */
+class GzipReader {
+ private:
+  int fd;
+  size_t whole_limit;
+  z_stream zs;
+  std::vector<unsigned char> in;
+  std::vector<unsigned char> out;
+  bool in_eof = false;
+  bool in_member = false;
+  bool decoded = false;  // `out` holds the whole decompressed stream
+  std::string error;
+
+  bool inflate_whole();
+  ssize_t fill();
+  static la_ssize_t read_cb(archive* a, void* self, const void** buff);
+
+ public:
+  // Default for `whole_limit`, the decompressed bytes held in memory
+  static constexpr size_t default_whole_limit = size_t{64} << 20;
+
+  explicit GzipReader(const std::filesystem::path& path,
+                      size_t whole_limit = default_whole_limit);
+  ~GzipReader();
+
+  GzipReader(const GzipReader&) = delete;
+  GzipReader& operator=(const GzipReader&) = delete;
+
+  // Open `reader` on the decompressed stream. Only register formats, not
+  // filters, on `reader`.
+  void open(archive* reader);
+
+  // Decompress and verify the rest of the gzip stream
+  void drain();
+
+  // Whether decompression is faster than libarchive's gzip filter
+  static bool accelerated();
+
+  // Memory needed to decompress the gzip file at `path` with `whole_limit`
+  static uint64_t memory(const std::filesystem::path& path,
+                         size_t whole_limit = default_whole_limit);
+};
+
+}  // namespace xwim
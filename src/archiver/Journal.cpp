@@ -0,0 +1,71 @@
+#include "Journal.hpp"
+
+#include <fmt/core.h>
+#include <sys/stat.h>
+
+#include <cerrno>
+#include <cinttypes>
+#include <cstdio>
+#include <cstring>
+
+#include "../util/Common.hpp"
+
+namespace xwim {
+
+Journal Journal::start(const std::filesystem::path& archive) {
+  struct stat st;
+  if (stat(archive.c_str(), &st) != 0) {
+    throw XwimError{"Cannot stat {}. {}", archive, std::strerror(errno)};
+  }
+
+  Journal journal;
+  journal.archive_size = st.st_size;
+  journal.archive_mtime_ns =
+      int64_t{st.st_mtim.tv_sec} * 1000000000 + st.st_mtim.tv_nsec;
+  return journal;
+}
+
+std::optional<Journal> Journal::load(const std::filesystem::path& path) {
+  std::FILE* file = std::fopen(path.c_str(), "r");
+  if (!file) return std::nullopt;
+
+  Journal journal;
+  int n = std::fscanf(file,
+                      "xwim-journal 1\n"
+                      "archive-size %ju\n"
+                      "archive-mtime %" SCNd64 "\n"
+                      "entries %" SCNu64 "\n",
+                      &journal.archive_size, &journal.archive_mtime_ns,
+                      &journal.entries);
+  std::fclose(file);
+
+  if (n != 3) return std::nullopt;
+  return journal;
+}
+
+void Journal::save(const std::filesystem::path& path) const {
+  std::filesystem::path tmp = path;
+  tmp += ".tmp";
+
+  std::FILE* file = std::fopen(tmp.c_str(), "w");
+  if (!file) {
+    throw XwimError{"Failed opening journal {}. {}", tmp,
+                    std::strerror(errno)};
+  }
+
+  fmt::print(file,
+             "xwim-journal 1\n"
+             "archive-size {}\n"
+             "archive-mtime {}\n"
+             "entries {}\n",
+             this->archive_size, this->archive_mtime_ns, this->entries);
+
+  bool failed = std::ferror(file) != 0;
+  failed |= std::fclose(file) != 0;
+  if (failed) throw XwimError{"Failed writing journal {}", tmp};
+
+  // A reader sees either the previous or the new journal, never a partial one
+  std::filesystem::rename(tmp, path);
+}
+
+}  // namespace xwim
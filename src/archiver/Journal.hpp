@@ -0,0 +1,49 @@
+#pragma once
+
+#include <cstdint>
+#include <filesystem>
+#include <optional>
+#include <string>
+
+namespace xwim {
+
+/**
+ * Progress of an extraction, kept in the output folder so a killed
+ * extraction can be resumed.
+ *
+ * The archive is identified by its size and modification time. A journal
+ * written for a different (or changed) archive does not match and is
+ * ignored.
+ *
+ * Only the number of finished entries is recorded. Compressed streams cannot
+ * be entered in the middle, resuming reads them from the start and skips the
+ * data of finished entries.
+ */
+struct Journal {
+  // Name of the journal file for `archive` in the output folder. Shards of an
+  // archive are extracted into the same folder concurrently.
+  static std::string file_name(const std::filesystem::path& archive) {
+    return "." + archive.filename().string() + ".xwim-journal";
+  }
+
+  uintmax_t archive_size = 0;
+  int64_t archive_mtime_ns = 0;
+  // Number of leading entries completely extracted
+  uint64_t entries = 0;
+
+  // Journal for extracting `archive` from the start
+  static Journal start(const std::filesystem::path& archive);
+
+  // @returns std::nullopt if there is no readable journal at `path`
+  static std::optional<Journal> load(const std::filesystem::path& path);
+
+  // Replace the journal at `path` atomically, throws `XwimError` on failure
+  void save(const std::filesystem::path& path) const;
+
+  bool same_archive(const Journal& other) const {
+    return this->archive_size == other.archive_size &&
+           this->archive_mtime_ns == other.archive_mtime_ns;
+  }
+};
+
+}  // namespace xwim
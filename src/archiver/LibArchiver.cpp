@@ -2,42 +2,164 @@
 #include <archive_entry.h>
 #include <fcntl.h>
 #include <fmt/core.h>
-#include <spdlog/spdlog.h>
+#include <errno.h>
+#include <string.h>
 #include <sys/stat.h>
+#include <unistd.h>
 
+#ifdef __linux__
+#include <linux/fiemap.h>
+#include <linux/fs.h>
+#include <sys/ioctl.h>
+#endif
+
+#include <algorithm>
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <exception>
 #include <filesystem>
 #include <iostream>
+#include <map>
 #include <memory>
+#include <mutex>
+#include <optional>
+#include <string>
+#include <thread>
+#include <tuple>
+#include <vector>
 
 #include "../Archiver.hpp"
+#include "GzipReader.hpp"
+#include "Journal.hpp"
+#include "Memory.hpp"
+#include "ZipIndex.hpp"
+#include "ZipWriter.hpp"
 #include "../util/Common.hpp"
+#include "../util/Hash.hpp"
+#include "../util/Log.hpp"
+#include "../util/Parallel.hpp"
+#include "../util/Trace.hpp"
 
 namespace xwim {
 using namespace std;
 namespace fs = std::filesystem;
 
-static int copy_data(shared_ptr<archive> reader, shared_ptr<archive> writer);
+// Entries smaller than this are not worth an extra open for preallocation
+static constexpr int64_t preallocate_min_size = 1 << 20;
+// The extraction journal is saved after this many entries or bytes
+static constexpr uint64_t journal_interval_entries = 1024;
+static constexpr int64_t journal_interval_bytes = 64 << 20;
+// Smaller files are not worth comparing for deduplication
+static constexpr int64_t dedup_min_size = 4096;
+// Files of the same size an entry is compared with for deduplication
+static constexpr size_t dedup_candidates_per_size = 8;
+
+static void set_format_filter(shared_ptr<archive> writer, Format format);
+static int copy_data(shared_ptr<archive> reader, shared_ptr<archive> writer,
+                     Hasher* hasher = nullptr, int64_t size = 0,
+                     int64_t hashed = 0);
+static void test_entries(const fs::path& archive_in, size_t first,
+                         size_t last, uint64_t gzip_whole);
+static void open_archive(shared_ptr<archive> reader, const fs::path& archive_in,
+                         unique_ptr<GzipReader>& gzip, uint64_t gzip_whole);
+static void preflight(const fs::path& archive_in, const fs::path& out,
+                      bool skip_extracted);
+static void preallocate(const char* path, int64_t size);
+static bool is_extracted(archive_entry* entry);
+static fs::path resolve(const fs::path& out, const fs::path& name,
+                        const optional<fs::path>& flattened);
+static bool clone_file(const fs::path& source, const char* path);
+static void hash_file(const char* path, Hasher& hasher);
+
+// A file extracted before, duplicates of it are linked to it (`dedup`)
+struct Extracted {
+  fs::path path;
+  mode_t perm;
+  time_t mtime;
+  long mtime_nsec;
+};
+
+// The temporary file a changed entry is written to (`update`). Removed
+// unless released once it replaced the existing file.
+class TempFile {
+ private:
+  fs::path path;
+
+ public:
+  explicit TempFile(fs::path path) : path(std::move(path)) {}
+  ~TempFile() {
+    std::error_code ec;
+    if (!this->path.empty()) fs::remove(this->path, ec);
+  }
+
+  TempFile(const TempFile&) = delete;
+  TempFile& operator=(const TempFile&) = delete;
+
+  void release() { this->path.clear(); }
+};
+
+// Where the data of an entry starts to differ from an existing file
+struct Difference {
+  int64_t offset;  // length of the identical prefix
+  // First block read from the entry that is not identical, if any
+  const void* buff = nullptr;
+  size_t len = 0;
+  int64_t buff_offset = 0;
+};
+
+static optional<Difference> compare_data(shared_ptr<archive> reader,
+                                         const vector<fs::path>& paths,
+                                         Hasher* hasher, size_t& closest);
+static void copy_prefix(shared_ptr<archive> writer, const fs::path& path,
+                        int64_t len);
+static void write_entry(shared_ptr<archive> writer, archive_entry* entry,
+                        Hasher* hasher, Manifest* manifest);
+static void order_entries(vector<shared_ptr<archive_entry>>& entries,
+                          Ordering ordering);
 
 void LibArchiver::compress(set<fs::path> ins, fs::path archive_out) {
-  spdlog::debug("Compressing to {}", archive_out);
+  log::debug("Compressing to {}", archive_out);
   int r;  // libarchive error handling
-  static char buff[16384]; // read buffer
+
+  // Zip entries are compressed independently, deflate them concurrently
+  // with our own writer instead of one by one through libarchive
+  unsigned workers = worker_count(this->opts.threads);
+  bool parallel_zip = workers > 1 && parse_format(archive_out) == Format::ZIP;
 
   // cannot use unique_ptr here since unique_ptr requires a
   // complete type. `archive` is forward declared only.
   shared_ptr<archive> writer;
-  writer = shared_ptr<archive>(archive_write_new(), archive_write_free);
-//  archive_write_add_filter_gzip(writer.get());
-//  archive_write_set_format_pax_restricted(writer.get());
-  archive_write_set_format_filter_by_ext(writer.get(), archive_out.c_str());
-  archive_write_open_filename(writer.get(), archive_out.c_str());
+  if (!parallel_zip) {
+    writer = shared_ptr<archive>(archive_write_new(), archive_write_free);
+    set_format_filter(writer, parse_format(archive_out));
+
+    {
+      trace::Span span{"open_archive", archive_out};
+      r = archive_write_open_filename(writer.get(), archive_out.c_str());
+    }
+    if (r != ARCHIVE_OK) {
+      throw XwimError{"Failed opening {}. {}", archive_out,
+                      archive_error_string(writer.get())};
+    }
+  }
 
   shared_ptr<archive> reader;
 
   shared_ptr<archive_entry> entry = shared_ptr<archive_entry>(archive_entry_new(), archive_entry_free);
 
+  unique_ptr<Hasher> hasher;
+  if (this->manifest) {
+    hasher = make_unique<Hasher>(this->manifest->algorithm());
+  }
+
+  // Entries are only collected if they need to be reordered or are written
+  // concurrently. Otherwise they are written in the order the file system
+  // walk returns them.
+  vector<shared_ptr<archive_entry>> entries;
+
   for (auto in : ins) {
-    spdlog::debug("Compressing {}", in);
+    XWIM_LOG_DEBUG("Compressing {}", in);
     reader = shared_ptr<archive>(archive_read_disk_new(), archive_read_free);
     archive_read_disk_set_standard_lookup(reader.get());
 
@@ -48,7 +170,10 @@ void LibArchiver::compress(set<fs::path> ins, fs::path archive_out) {
     }
 
     for (;;) {
-      r = archive_read_next_header2(reader.get(), entry.get());
+      {
+        trace::Span span{"read_header"};
+        r = archive_read_next_header2(reader.get(), entry.get());
+      }
 
       if (r == ARCHIVE_EOF) break;
 
@@ -57,56 +182,110 @@ void LibArchiver::compress(set<fs::path> ins, fs::path archive_out) {
                         archive_error_string(reader.get())};
       }
 
-      spdlog::debug("Adding {} to archive", archive_entry_pathname(entry.get()));
-      r = archive_write_header(writer.get(), entry.get());
-      if (r != ARCHIVE_OK) {
-        throw XwimError{"Failed writing archive entry. {}",
-                        archive_error_string(writer.get())};
-      }
-
-      /* For now, we use a simpler loop to copy data
-       * into the target archive. */
-      int fd = open(archive_entry_sourcepath(entry.get()), O_RDONLY);
-      ssize_t len = read(fd, buff, sizeof(buff));
-      while (len > 0) {
-        archive_write_data(writer.get(), buff, len);
-        len = read(fd, buff, sizeof(buff));
+      if (this->opts.ordering == Ordering::DISK && !parallel_zip) {
+        write_entry(writer, entry.get(), hasher.get(), this->manifest);
+      } else {
+        entries.push_back(shared_ptr<archive_entry>(
+            archive_entry_clone(entry.get()), archive_entry_free));
       }
-      close(fd);
 
       archive_entry_clear(entry.get());
-      archive_read_disk_descend(reader.get());
+      if (this->recursive) archive_read_disk_descend(reader.get());
     }
   }
+
+  if (this->opts.ordering != Ordering::DISK) {
+    order_entries(entries, this->opts.ordering);
+  }
+
+  if (parallel_zip) {
+    zip::write_parallel(archive_out, entries, workers, this->manifest,
+                        buffer_sizes(this->opts).zip_window);
+    return;
+  }
+
+  for (auto& e : entries) {
+    write_entry(writer, e.get(), hasher.get(), this->manifest);
+  }
+
+  // Filters flush their last block and write errors surface only on close
+  {
+    trace::Span span{"close_archive", archive_out};
+    r = archive_write_close(writer.get());
+  }
+  if (r != ARCHIVE_OK) {
+    throw XwimError{"Failed writing {}. {}", archive_out,
+                    archive_error_string(writer.get())};
+  }
 }
 
 void LibArchiver::extract(fs::path archive_in, fs::path out) {
-  spdlog::debug("Extracting archive {} to {}", archive_in, out);
+  log::debug("Extracting archive {} to {}", archive_in, out);
   int r;  // libarchive error handling
 
   // cannot use unique_ptr here since unique_ptr requires a
   // complete type. `archive` is forward declared only.
   shared_ptr<archive> reader;
   reader = shared_ptr<archive>(archive_read_new(), archive_read_free);
-  archive_read_support_filter_all(reader.get());
-  archive_read_support_format_all(reader.get());
-  r = archive_read_open_filename(reader.get(), archive_in.c_str(), 10240);
-  if (r != ARCHIVE_OK) {
-    throw XwimError{"Failed opening archive {}. {}", archive_in,
-                    archive_error_string(reader.get())};
-  }
+  unique_ptr<GzipReader> gzip;
+  open_archive(reader, archive_in, gzip, buffer_sizes(this->opts).gzip_whole);
 
   shared_ptr<archive> writer;
   writer = shared_ptr<archive>(archive_write_disk_new(), archive_write_free);
   archive_write_disk_set_standard_lookup(writer.get());
+  // Restore modification times, `--resume` relies on them
+  archive_write_disk_set_options(writer.get(), ARCHIVE_EXTRACT_TIME);
 
+  // Check the space before creating `out`, so a failing preflight leaves
+  // nothing behind
+  preflight(archive_in, out, this->opts.resume || this->opts.update);
   fs::create_directories(out);
-  fs::path cur_path = fs::current_path();
-  fs::current_path(out);
+
+  // Entries before `resume_from` were finished by a previous run and are only
+  // skipped if they are still intact on disk.
+  //
+  // The journal is kept without `--resume`, too: the run that gets killed is
+  // the one that has to leave it behind. It is saved every
+  // `journal_interval_entries` entries or `journal_interval_bytes` bytes only,
+  // so small archives never write it. `--update` checks every entry on disk
+  // anyway and has no use for it.
+  bool journaling = !this->opts.update;
+  fs::path journal_path = out / Journal::file_name(archive_in);
+  Journal journal = Journal::start(archive_in);
+  uint64_t resume_from = 0;
+  if (this->opts.resume) {
+    optional<Journal> previous = Journal::load(journal_path);
+    if (previous && previous->same_archive(journal)) {
+      resume_from = previous->entries;
+      log::info("Resuming extraction of {} after {} entries", archive_in,
+                resume_from);
+    } else {
+      log::info("No journal for {} in {}, extracting all entries", archive_in,
+                out);
+    }
+  }
+  uint64_t index = 0;
+  uint64_t journaled = 0;
+  int64_t unjournaled_bytes = 0;
+
+  unique_ptr<Hasher> hasher;
+  if (this->manifest) {
+    hasher = make_unique<Hasher>(this->manifest->algorithm());
+  }
+  string name;
+
+  // The last files extracted of each size, most recent first. Entries are
+  // compared with these only.
+  map<int64_t, deque<Extracted>> dedup_candidates;
+  uint64_t deduplicated = 0;
+  int64_t deduplicated_bytes = 0;
 
   archive_entry *entry;
-  for (;;) {
-    r = archive_read_next_header(reader.get(), &entry);
+  for (;; index++) {
+    {
+      trace::Span span{"read_header"};
+      r = archive_read_next_header(reader.get(), &entry);
+    }
     if (r == ARCHIVE_EOF) break;
 
     if (r != ARCHIVE_OK) {
@@ -114,25 +293,226 @@ void LibArchiver::extract(fs::path archive_in, fs::path out) {
                       archive_error_string(reader.get())};
     }
 
-    r = archive_write_header(writer.get(), entry);
+    XWIM_LOG_DEBUG("Extracting {}", archive_entry_pathname(entry));
+
+    bool hash = hasher && archive_entry_filetype(entry) == AE_IFREG &&
+                !archive_entry_hardlink(entry);
+    if (hash) hasher->reset();
+
+    // Resolve entries against `out` instead of changing the process-wide
+    // working directory, so extractions can run next to other work
+    archive_entry_set_pathname(
+        entry, resolve(out, archive_entry_pathname(entry), this->flattened)
+                   .c_str());
+    if (archive_entry_hardlink(entry)) {
+      archive_entry_set_hardlink(
+          entry, resolve(out, archive_entry_hardlink(entry), this->flattened)
+                     .c_str());
+    }
+    if (hash) name = archive_entry_pathname(entry);
+
+    // Keep files finished by an interrupted run (`--resume`) or unchanged
+    // since the last extraction (`--update`). Seekable formats (zip) jump over
+    // the data of skipped entries, streams still have to decompress it but
+    // nothing is written.
+    if ((index < resume_from || this->opts.update) && is_extracted(entry)) {
+      XWIM_LOG_DEBUG("{} is up to date", archive_entry_pathname(entry));
+      if (hash) {
+        hash_file(archive_entry_pathname(entry), *hasher);
+        this->manifest->add(hasher->digest(), name);
+      }
+
+      r = archive_read_data_skip(reader.get());
+      if (r != ARCHIVE_OK) {
+        throw XwimError{"Failed skipping archive entry. {}",
+                        archive_error_string(reader.get())};
+      }
+      continue;
+    }
+
+    // Changed files are written next to the existing file and replace it once
+    // complete. With `update_content`, files that differ in modification
+    // time only are compared first and not written at all if identical.
+    optional<fs::path> replace;
+    optional<TempFile> tmp_file;
+    optional<Difference> difference;
+    fs::path compared;  // the file `difference` refers to
+    struct stat st;
+    if (this->opts.update && archive_entry_filetype(entry) == AE_IFREG &&
+        !archive_entry_hardlink(entry) &&
+        lstat(archive_entry_pathname(entry), &st) == 0 && S_ISREG(st.st_mode)) {
+      replace = archive_entry_pathname(entry);
+
+      if (this->opts.update_content &&
+          st.st_size == archive_entry_size(entry) &&
+          archive_entry_sparse_count(entry) == 0) {
+        trace::Span span{"compare_data", archive_entry_pathname(entry)};
+        compared = replace.value();
+        size_t closest;
+        difference = compare_data(reader, {compared},
+                                  hash ? hasher.get() : nullptr, closest);
+
+        if (!difference) {
+          XWIM_LOG_DEBUG("{} is unchanged", archive_entry_pathname(entry));
+          if (archive_entry_mtime_is_set(entry)) {
+            struct timespec times[2] = {
+                {0, UTIME_OMIT},
+                {archive_entry_mtime(entry), archive_entry_mtime_nsec(entry)}};
+            utimensat(AT_FDCWD, archive_entry_pathname(entry), times, 0);
+          }
+          if (hash) this->manifest->add(hasher->digest(), name);
+          continue;
+        }
+      }
+
+      fs::path tmp = replace.value();
+      tmp.replace_filename(
+          fmt::format(".{}.xwim{}", tmp.filename(), rand_int(0, 100000)));
+      tmp_file.emplace(tmp);
+      archive_entry_set_pathname(entry, tmp.c_str());
+    }
+
+    // With `dedup`, files identical to one of the last files of the same size
+    // are linked to it instead of written. Their data is compared while it is
+    // read, a file that differs is written from where it starts to differ.
+    bool dedup = this->opts.dedup != Dedup::NONE && !replace &&
+                 archive_entry_filetype(entry) == AE_IFREG &&
+                 !archive_entry_hardlink(entry) &&
+                 archive_entry_size(entry) >= dedup_min_size &&
+                 archive_entry_sparse_count(entry) == 0;
+    optional<Extracted> duplicate;
+    if (dedup) {
+      auto candidates = dedup_candidates.find(archive_entry_size(entry));
+      if (candidates != dedup_candidates.end()) {
+        trace::Span span{"compare_data", archive_entry_pathname(entry)};
+        vector<fs::path> paths;
+        for (const auto& c : candidates->second) paths.push_back(c.path);
+        size_t closest;
+        difference = compare_data(reader, paths,
+                                  hash ? hasher.get() : nullptr, closest);
+        compared = paths[closest];
+        if (!difference) duplicate = candidates->second[closest];
+      }
+    }
+
+    int64_t duplicate_size = 0;
+    bool linked = false;
+    if (duplicate) {
+      XWIM_LOG_DEBUG("{} duplicates {}", archive_entry_pathname(entry),
+                     duplicate->path);
+      duplicate_size = archive_entry_size(entry);
+
+      // A hardlink shares metadata, too
+      if (this->opts.dedup == Dedup::HARDLINK &&
+          duplicate->perm == archive_entry_perm(entry) &&
+          archive_entry_mtime_is_set(entry) &&
+          duplicate->mtime == archive_entry_mtime(entry) &&
+          duplicate->mtime_nsec == archive_entry_mtime_nsec(entry)) {
+        archive_entry_set_hardlink(entry, duplicate->path.c_str());
+        archive_entry_set_size(entry, 0);
+        linked = true;
+        deduplicated++;
+        deduplicated_bytes += duplicate_size;
+      }
+    }
+
+    {
+      trace::Span span{"write_header", archive_entry_pathname(entry)};
+      r = archive_write_header(writer.get(), entry);
+    }
     if (r != ARCHIVE_OK) {
       throw XwimError{"Failed writing archive entry header. {}",
                       archive_error_string(writer.get())};
     }
 
-    if (archive_entry_size(entry) > 0) {
-      r = copy_data(reader, writer);
+    if (archive_entry_filetype(entry) == AE_IFREG &&
+        archive_entry_size(entry) >= preallocate_min_size &&
+        archive_entry_sparse_count(entry) == 0 &&
+        !archive_entry_hardlink(entry) && !duplicate) {
+      preallocate(archive_entry_pathname(entry), archive_entry_size(entry));
+    }
+
+    int64_t hashed = 0;
+    if (duplicate && !archive_entry_hardlink(entry)) {
+      // All data was consumed while comparing
+      trace::Span span{"clone_data", archive_entry_pathname(entry)};
+      if (clone_file(duplicate->path, archive_entry_pathname(entry))) {
+        linked = true;
+        deduplicated++;
+        deduplicated_bytes += duplicate_size;
+      } else {
+        copy_prefix(writer, duplicate->path, duplicate_size);
+      }
+    } else if (difference) {
+      // The identical prefix was consumed while comparing
+      copy_prefix(writer, compared, difference->offset);
+      if (difference->buff) {
+        if (hash) {
+          hasher->update_zeros(difference->buff_offset - difference->offset);
+          hasher->update(difference->buff, difference->len);
+        }
+        r = archive_write_data_block(writer.get(), difference->buff,
+                                     difference->len,
+                                     difference->buff_offset);
+        if (r != ARCHIVE_OK) {
+          throw XwimError{"Failed writing archive entry data. {}",
+                          archive_error_string(writer.get())};
+        }
+        hashed = difference->buff_offset + difference->len;
+      } else {
+        hashed = difference->offset;
+      }
+    }
+
+    if (archive_entry_size(entry) > 0 && !duplicate) {
+      trace::Span span{"copy_data", archive_entry_pathname(entry)};
+      r = copy_data(reader, writer, hash ? hasher.get() : nullptr,
+                    archive_entry_size(entry), hashed);
       if (r != ARCHIVE_OK) {
-        throw XwimError{"Failed writing archive entry data. {}",
-                        archive_error_string(writer.get())};
+        // Either side may have failed
+        const char* error = archive_error_string(writer.get());
+        if (!error) error = archive_error_string(reader.get());
+        throw XwimError{"Failed extracting archive entry data. {}",
+                        error ? error : "unknown error"};
       }
     }
 
-    r = archive_write_finish_entry(writer.get());
+    if (hash) this->manifest->add(hasher->digest(), name);
+
+    {
+      trace::Span span{"finish_entry", archive_entry_pathname(entry)};
+      r = archive_write_finish_entry(writer.get());
+    }
     if (r != ARCHIVE_OK) {
       throw XwimError{"Failed finishing archive entry data. {}",
                       archive_error_string(writer.get())};
     }
+
+    if (replace) {
+      fs::rename(archive_entry_pathname(entry), replace.value());
+      tmp_file->release();
+    }
+
+    // Copies, too: their metadata may suit later hardlinks better
+    if (dedup && !linked) {
+      deque<Extracted>& candidates =
+          dedup_candidates[archive_entry_size(entry)];
+      candidates.push_front(Extracted{
+          archive_entry_pathname(entry), archive_entry_perm(entry),
+          archive_entry_mtime(entry), archive_entry_mtime_nsec(entry)});
+      if (candidates.size() > dedup_candidates_per_size) {
+        candidates.pop_back();
+      }
+    }
+
+    unjournaled_bytes += archive_entry_size(entry);
+    if (journaling && (index + 1 - journaled >= journal_interval_entries ||
+                       unjournaled_bytes >= journal_interval_bytes)) {
+      trace::Span span{"save_journal"};
+      journal.entries = journaled = index + 1;
+      journal.save(journal_path);
+      unjournaled_bytes = 0;
+    }
   }
 
   if (r != ARCHIVE_OK && r != ARCHIVE_EOF) {
@@ -140,28 +520,845 @@ void LibArchiver::extract(fs::path archive_in, fs::path out) {
                     archive_error_string(reader.get())};
   }
 
-  fs::current_path(cur_path);
+  if (gzip) gzip->drain();
+  fs::remove(journal_path);
+
+  if (deduplicated > 0) {
+    log::info("Linked {} duplicate files ({} bytes) in {}", deduplicated,
+              deduplicated_bytes, out);
+  }
+}
+
+void LibArchiver::test(fs::path archive_in) {
+  log::debug("Testing archive {}", archive_in);
+
+  // Zip entries are compressed independently and can be located via the
+  // central directory. Workers test contiguous ranges of entries of roughly
+  // equal compressed size. Everything else is a single stream.
+  vector<size_t> bounds{0, SIZE_MAX};
+  unsigned workers = worker_count(this->opts.threads);
+  if (workers > 1 && find_extension_format(archive_extension(archive_in)
+                                               .string()) == Format::ZIP) {
+    if (auto cd = zip::read_central_directory(archive_in)) {
+      sort(cd->begin(), cd->end(), [](const auto& a, const auto& b) {
+        return a.local_header_offset < b.local_header_offset;
+      });
+
+      uint64_t total = 0;
+      for (const auto& e : cd.value()) total += e.compressed_size;
+
+      bounds = {0};
+      uint64_t acc = 0;
+      for (size_t i = 0; i < cd->size(); i++) {
+        acc += cd->at(i).compressed_size;
+        if (acc * workers >= total * bounds.size() && i + 1 < cd->size()) {
+          bounds.push_back(i + 1);
+        }
+      }
+      bounds.push_back(SIZE_MAX);
+    }
+  }
+
+  uint64_t gzip_whole = buffer_sizes(this->opts).gzip_whole;
+  parallel_for(bounds.size() - 1, workers, [&](size_t k) {
+    test_entries(archive_in, bounds[k], bounds[k + 1], gzip_whole);
+  });
 }
 
-static int copy_data(shared_ptr<archive> reader, shared_ptr<archive> writer) {
+// Decode entries [first, last) of `archive_in`, skip over all others
+static void test_entries(const fs::path& archive_in, size_t first,
+                         size_t last, uint64_t gzip_whole) {
+  int r;  // libarchive error handling
+
+  // libarchive does not verify gzip checksums, decompress with zlib instead
+  unique_ptr<GzipReader> gzip;
+  if (find_extension_format(archive_extension(archive_in).string()) ==
+      Format::TAR_GZIP) {
+    gzip = make_unique<GzipReader>(archive_in, gzip_whole);
+  }
+
+  shared_ptr<archive> reader;
+  reader = shared_ptr<archive>(archive_read_new(), archive_read_free);
+  archive_read_support_format_all(reader.get());
+  if (gzip) {
+    gzip->open(reader.get());
+  } else {
+    archive_read_support_filter_all(reader.get());
+    trace::Span span{"open_archive", archive_in};
+    r = archive_read_open_filename(reader.get(), archive_in.c_str(), 10240);
+    if (r != ARCHIVE_OK) {
+      throw XwimError{"Failed opening archive {}. {}", archive_in,
+                      archive_error_string(reader.get())};
+    }
+  }
+
+  archive_entry* entry;
+  for (size_t i = 0; i < last; i++) {
+    {
+      trace::Span span{"read_header"};
+      r = archive_read_next_header(reader.get(), &entry);
+    }
+    if (r == ARCHIVE_EOF) break;
+
+    if (r != ARCHIVE_OK) {
+      throw XwimError{"Failed reading archive entry. {}",
+                      archive_error_string(reader.get())};
+    }
+
+    if (i < first) {
+      r = archive_read_data_skip(reader.get());
+    } else {
+      trace::Span span{"read_data", archive_entry_pathname(entry)};
+      const void* buff;
+      size_t size;
+      int64_t offset;
+      do {
+        r = archive_read_data_block(reader.get(), &buff, &size, &offset);
+      } while (r == ARCHIVE_OK);
+      if (r == ARCHIVE_EOF) r = ARCHIVE_OK;
+    }
+
+    if (r != ARCHIVE_OK) {
+      throw XwimError{"Failed reading {}. {}", archive_entry_pathname(entry),
+                      archive_error_string(reader.get())};
+    }
+  }
+
+  // Data after the end of the archive, e.g. gzip trailers, was not read yet
+  if (gzip) gzip->drain();
+}
+
+// Open `archive_in` on `reader`. `.tar.gz` archives are decoded by `gzip`
+// instead of libarchive's filter where that is faster, in one go if the
+// archive and its content fit into `gzip_whole`.
+static void open_archive(shared_ptr<archive> reader, const fs::path& archive_in,
+                         unique_ptr<GzipReader>& gzip, uint64_t gzip_whole) {
+  archive_read_support_format_all(reader.get());
+
+  if (GzipReader::accelerated() &&
+      find_extension_format(archive_extension(archive_in).string()) ==
+          Format::TAR_GZIP) {
+    gzip = make_unique<GzipReader>(archive_in, gzip_whole);
+    trace::Span span{"open_archive", archive_in};
+    gzip->open(reader.get());
+    return;
+  }
+
+  archive_read_support_filter_all(reader.get());
+  trace::Span span{"open_archive", archive_in};
+  int r = archive_read_open_filename(reader.get(), archive_in.c_str(), 10240);
+  if (r != ARCHIVE_OK) {
+    throw XwimError{"Failed opening archive {}. {}", archive_in,
+                    archive_error_string(reader.get())};
+  }
+}
+
+// An entry header or a data block on its way from the decoding to the
+// encoding thread of `convert`
+struct Block {
+  shared_ptr<archive_entry> entry;  // header of the next entry, if set
+  string data;
+  int64_t offset = 0;
+};
+
+// Blocks in flight between the threads of `convert`. `push` waits while
+// `capacity` bytes of data are queued, `pop` while none are.
+class Pipe {
+ private:
+  std::mutex mutex;
+  std::condition_variable changed;
+  deque<Block> blocks;
+  size_t bytes = 0;
+  size_t capacity;
+  bool closed = false;     // no more blocks will be pushed
+  bool cancelled = false;  // no more blocks will be popped
+  exception_ptr error;
+
+ public:
+  explicit Pipe(size_t capacity) : capacity(capacity) {}
+
+  // Returns false if the encoding side gave up
+  bool push(Block block) {
+    unique_lock<std::mutex> lock{this->mutex};
+    this->changed.wait(lock, [&] {
+      return this->cancelled || this->blocks.empty() ||
+             this->bytes + block.data.size() <= this->capacity;
+    });
+    if (this->cancelled) return false;
+
+    this->bytes += block.data.size();
+    this->blocks.push_back(std::move(block));
+    this->changed.notify_all();
+    return true;
+  }
+
+  // End the stream, `pop` rethrows `error` once all blocks are taken
+  void close(exception_ptr error = nullptr) {
+    lock_guard<std::mutex> lock{this->mutex};
+    this->closed = true;
+    this->error = error;
+    this->changed.notify_all();
+  }
+
+  void cancel() {
+    lock_guard<std::mutex> lock{this->mutex};
+    this->cancelled = true;
+    this->changed.notify_all();
+  }
+
+  // Returns false at the end of the stream
+  bool pop(Block& block) {
+    unique_lock<std::mutex> lock{this->mutex};
+    this->changed.wait(lock,
+                       [&] { return this->closed || !this->blocks.empty(); });
+    if (this->blocks.empty()) {
+      if (this->error) rethrow_exception(this->error);
+      return false;
+    }
+
+    block = std::move(this->blocks.front());
+    this->blocks.pop_front();
+    this->bytes -= block.data.size();
+    this->changed.notify_all();
+    return true;
+  }
+};
+
+// Decode all entries of `archives_in` into `pipe`. Data of an entry without
+// a known size is held back, up to `hold_limit` bytes.
+static void decode_archives(const vector<fs::path>& archives_in, Pipe& pipe,
+                            uint64_t gzip_whole, uint64_t hold_limit) {
+  int r;  // libarchive error handling
+
+  for (const fs::path& archive_in : archives_in) {
+    shared_ptr<archive> reader;
+    reader = shared_ptr<archive>(archive_read_new(), archive_read_free);
+    unique_ptr<GzipReader> gzip;
+    open_archive(reader, archive_in, gzip, gzip_whole);
+
+    archive_entry* entry;
+    for (;;) {
+      {
+        trace::Span span{"read_header"};
+        r = archive_read_next_header(reader.get(), &entry);
+      }
+      if (r == ARCHIVE_EOF) break;
+
+      if (r != ARCHIVE_OK) {
+        throw XwimError{"Failed reading archive entry. {}",
+                        archive_error_string(reader.get())};
+      }
+
+      Block header;
+      header.entry = shared_ptr<archive_entry>(archive_entry_clone(entry),
+                                               archive_entry_free);
+      if (archive_entry_filetype(entry) != AE_IFREG) {
+        if (!pipe.push(std::move(header))) return;
+        continue;
+      }
+
+      // Tar headers need the size up front. Zip entries get it from the
+      // central directory, only zips read without one (e.g. with a damaged
+      // end record) may lack it. Their data is held back until the size is
+      // known.
+      bool buffer = !archive_entry_size_is_set(entry);
+      vector<Block> blocks;
+      if (!buffer && !pipe.push(header)) return;
+
+      trace::Span span{"read_data", archive_entry_pathname(entry)};
+      const void* buff;
+      size_t len;
+      int64_t offset;
+      int64_t end = 0;
+      while ((r = archive_read_data_block(reader.get(), &buff, &len,
+                                          &offset)) == ARCHIVE_OK) {
+        if (len == 0) continue;
+        Block block{nullptr, string{static_cast<const char*>(buff), len},
+                    offset};
+        end = max<int64_t>(end, offset + len);
+        if (buffer) {
+          if (uint64_t(end) > hold_limit) {
+            throw XwimError{"Cannot convert {}, its size is unknown and its "
+                            "data exceeds {} bytes",
+                            archive_entry_pathname(entry), hold_limit};
+          }
+          blocks.push_back(std::move(block));
+        } else if (!pipe.push(std::move(block))) {
+          return;
+        }
+      }
+      if (r != ARCHIVE_EOF) {
+        throw XwimError{"Failed reading {}. {}", archive_entry_pathname(entry),
+                        archive_error_string(reader.get())};
+      }
+
+      if (buffer) {
+        archive_entry_set_size(header.entry.get(), end);
+        if (!pipe.push(std::move(header))) return;
+        for (auto& block : blocks) {
+          if (!pipe.push(std::move(block))) return;
+        }
+      }
+    }
+
+    if (gzip) gzip->drain();
+  }
+}
+
+// Write `len` zero bytes, i.e. a hole of a sparse entry, to `writer`
+static void write_zeros(shared_ptr<archive> writer, int64_t len) {
+  static const char zeros[16384] = {};
+
+  while (len > 0) {
+    la_ssize_t n = archive_write_data(
+        writer.get(), zeros, min<int64_t>(len, sizeof(zeros)));
+    if (n <= 0) {
+      throw XwimError{"Failed writing archive entry data. {}",
+                      archive_error_string(writer.get())};
+    }
+    len -= n;
+  }
+}
+
+void LibArchiver::convert(vector<fs::path> archives_in,
+                          fs::path archive_out) {
+  log::debug("Converting {} archive(s) to {}", archives_in.size(),
+             archive_out);
+  int r;  // libarchive error handling
+
+  shared_ptr<archive> writer;
+  writer = shared_ptr<archive>(archive_write_new(), archive_write_free);
+  set_format_filter(writer, parse_format(archive_out));
+  {
+    trace::Span span{"open_archive", archive_out};
+    r = archive_write_open_filename(writer.get(), archive_out.c_str());
+  }
+  if (r != ARCHIVE_OK) {
+    throw XwimError{"Failed opening {}. {}", archive_out,
+                    archive_error_string(writer.get())};
+  }
+
+  unique_ptr<Hasher> hasher;
+  if (this->manifest) {
+    hasher = make_unique<Hasher>(this->manifest->algorithm());
+  }
+
+  // Decoding runs on its own thread, at most `convert_pipe` bytes of data
+  // ahead of encoding. An entry of unknown size may hold as much again.
+  Buffers buffers = buffer_sizes(this->opts);
+  Pipe pipe{buffers.convert_pipe};
+  trace::Recorder* recorder = trace::current();
+  std::thread decoder{[&] {
+    trace::Attach attach{recorder};
+    try {
+      decode_archives(archives_in, pipe, buffers.gzip_whole,
+                      buffers.convert_pipe);
+      pipe.close();
+    } catch (...) {
+      pipe.close(current_exception());
+    }
+  }};
+
+  try {
+    shared_ptr<archive_entry> entry;  // entry being written
+    int64_t written = 0;              // data bytes of `entry` written
+
+    // Fill trailing holes and record the entry in the manifest
+    auto finish_entry = [&] {
+      if (!entry || archive_entry_filetype(entry.get()) != AE_IFREG) return;
+
+      int64_t size = archive_entry_size(entry.get());
+      if (size > written) {
+        write_zeros(writer, size - written);
+        if (hasher) hasher->update_zeros(size - written);
+      }
+      if (hasher) {
+        this->manifest->add(hasher->digest(),
+                            archive_entry_pathname(entry.get()));
+      }
+    };
+
+    Block block;
+    while (pipe.pop(block)) {
+      if (block.entry) {
+        finish_entry();
+        entry = block.entry;
+        written = 0;
+        if (hasher) hasher->reset();
+
+        XWIM_LOG_DEBUG("Converting {}", archive_entry_pathname(entry.get()));
+        trace::Span span{"write_header", archive_entry_pathname(entry.get())};
+        r = archive_write_header(writer.get(), entry.get());
+        if (r != ARCHIVE_OK) {
+          throw XwimError{"Failed writing archive entry. {}",
+                          archive_error_string(writer.get())};
+        }
+        continue;
+      }
+
+      trace::Span span{"write_data"};
+      // Holes of sparse entries are written out as zeros
+      if (block.offset > written) {
+        write_zeros(writer, block.offset - written);
+        if (hasher) hasher->update_zeros(block.offset - written);
+      }
+      if (hasher) hasher->update(block.data.data(), block.data.size());
+      if (archive_write_data(writer.get(), block.data.data(),
+                             block.data.size()) < 0) {
+        throw XwimError{"Failed writing archive entry data. {}",
+                        archive_error_string(writer.get())};
+      }
+      written = block.offset + block.data.size();
+    }
+    finish_entry();
+  } catch (...) {
+    pipe.cancel();
+    decoder.join();
+    throw;
+  }
+  decoder.join();
+
+  {
+    trace::Span span{"close_archive", archive_out};
+    r = archive_write_close(writer.get());
+  }
+  if (r != ARCHIVE_OK) {
+    throw XwimError{"Failed writing {}. {}", archive_out,
+                    archive_error_string(writer.get())};
+  }
+}
+
+// Copy entry data from `reader` to `writer`. If given, `hasher` is fed the
+// entry content, including holes of sparse entries up to `size`, starting
+// after the first `hashed` bytes.
+static int copy_data(shared_ptr<archive> reader, shared_ptr<archive> writer,
+                     Hasher *hasher, int64_t size, int64_t hashed) {
   int r;
   const void *buff;
-  size_t size;
+  size_t len;
   int64_t offset;
 
   for (;;) {
-    r = archive_read_data_block(reader.get(), &buff, &size, &offset);
+    r = archive_read_data_block(reader.get(), &buff, &len, &offset);
     if (r == ARCHIVE_EOF) {
+      if (hasher && size > hashed) hasher->update_zeros(size - hashed);
       return (ARCHIVE_OK);
     }
     if (r != ARCHIVE_OK) {
       return (r);
     }
-    r = archive_write_data_block(writer.get(), buff, size, offset);
+    if (hasher) {
+      if (offset > hashed) hasher->update_zeros(offset - hashed);
+      hasher->update(buff, len);
+      hashed = offset + len;
+    }
+    r = archive_write_data_block(writer.get(), buff, len, offset);
     if (r != ARCHIVE_OK) {
       return (r);
     }
   }
 }
 
+// `archive_write_set_format_filter_by_ext` only knows a few of the
+// extensions in `format_extensions`, so map `Format` explicitly
+static void set_format_filter(shared_ptr<archive> writer, Format format) {
+  int r;  // libarchive error handling
+
+  if (format == Format::ZIP) {
+    r = archive_write_set_format_zip(writer.get());
+  } else {
+    r = archive_write_set_format_pax_restricted(writer.get());
+  }
+
+  if (r == ARCHIVE_OK) {
+    switch (format) {
+      case Format::TAR_BZIP2:
+        r = archive_write_add_filter_bzip2(writer.get());
+        break;
+      case Format::TAR_GZIP:
+        r = archive_write_add_filter_gzip(writer.get());
+        break;
+      case Format::TAR_LZIP:
+        r = archive_write_add_filter_lzip(writer.get());
+        break;
+      case Format::TAR_XZ:
+        r = archive_write_add_filter_xz(writer.get());
+        break;
+      case Format::TAR_COMPRESS:
+        r = archive_write_add_filter_compress(writer.get());
+        break;
+      case Format::TAR_ZSTD:
+        r = archive_write_add_filter_zstd(writer.get());
+        break;
+      default:
+        break;
+    }
+  }
+
+  // libarchive warns if it falls back to an external program
+  if (r != ARCHIVE_OK && r != ARCHIVE_WARN) {
+    throw XwimError{"Cannot write archive format. {}",
+                    archive_error_string(writer.get())};
+  }
+}
+
+// Fail early if the extracted size is known up front and does not fit into
+// `out`. Only zip archives declare their total size (in the central
+// directory), the size of compressed tar streams is unknown until decoded.
+// With `skip_extracted`, files already in `out` with the size of their entry
+// are not counted, `--resume` and `--update` keep them.
+static void preflight(const fs::path& archive_in, const fs::path& out,
+                      bool skip_extracted) {
+  if (find_extension_format(archive_extension(archive_in).string()) !=
+      Format::ZIP) {
+    return;
+  }
+
+  auto central_directory = zip::read_central_directory(archive_in);
+  if (!central_directory) {
+    log::debug("Cannot read central directory of {}, skipping preflight",
+               archive_in);
+    return;
+  }
+
+  uint64_t total = 0;
+  for (const auto& e : central_directory.value()) {
+    struct stat st;
+    if (skip_extracted && lstat((out / e.name).c_str(), &st) == 0 &&
+        S_ISREG(st.st_mode) &&
+        static_cast<uint64_t>(st.st_size) == e.uncompressed_size) {
+      continue;
+    }
+    total += e.uncompressed_size;
+  }
+
+  // `out` may not exist yet, check the file system it will be created on
+  fs::path existing = out;
+  while (!fs::exists(existing) && existing.has_relative_path()) {
+    existing = existing.parent_path();
+  }
+  if (existing.empty()) existing = ".";
+
+  std::error_code ec;
+  fs::space_info space = fs::space(existing, ec);
+  if (ec) return;
+
+  log::debug("Extracting {} bytes to {} ({} bytes available)", total, out,
+             space.available);
+  if (total > space.available) {
+    throw XwimError{"Not enough space to extract {}: {} bytes needed, {} bytes "
+                    "available in {}",
+                    archive_in, total, space.available, out};
+  }
+}
+
+// Reserve `size` bytes for a freshly created file so its data lands in few
+// extents and a full file system is detected before writing the data. The
+// file is removed again if it does not fit.
+static void preallocate(const char* path, int64_t size) {
+#ifdef __linux__
+  int fd = open(path, O_WRONLY | O_CLOEXEC);
+  if (fd < 0) return;
+
+  // Keep the size, libarchive still writes (and possibly skips holes) as usual
+  int r = fallocate(fd, FALLOC_FL_KEEP_SIZE, 0, size);
+  int err = errno;
+  close(fd);
+
+  if (r != 0 && err == ENOSPC) {
+    unlink(path);
+    throw XwimError{"Not enough space to extract {} ({} bytes)", path, size};
+  }
+#else
+  (void)path;
+  (void)size;
+#endif
+}
+
+// Path of the entry `name` below `out`. With `flattened`, names below that
+// top-level folder lose it.
+static fs::path resolve(const fs::path& out, const fs::path& name,
+                        const optional<fs::path>& flattened) {
+  auto it = name.begin();
+  if (!flattened || it == name.end() || *it != flattened.value()) {
+    return out / name;
+  }
+
+  fs::path below;
+  for (++it; it != name.end(); ++it) below /= *it;
+  return out / below;
+}
+
+// Whether the regular file `entry` was completely extracted already. The
+// modification time is restored only after all data is written, so a file
+// cut off mid-write does not match.
+static bool is_extracted(archive_entry* entry) {
+  if (archive_entry_filetype(entry) != AE_IFREG ||
+      archive_entry_hardlink(entry)) {
+    return false;
+  }
+
+  struct stat st;
+  if (lstat(archive_entry_pathname(entry), &st) != 0) return false;
+
+  return S_ISREG(st.st_mode) && st.st_size == archive_entry_size(entry) &&
+         (!archive_entry_mtime_is_set(entry) ||
+          st.st_mtime == archive_entry_mtime(entry));
+}
+
+// Read entry data from `reader` and compare it with the files at `paths`,
+// which have the same size, all at once. `hasher` is fed the identical data.
+// `closest` is set to the index of the file that is identical, or matches
+// the longest prefix.
+//
+// @returns std::nullopt if the data is identical to one of the files.
+//          Otherwise reading stops at the first block that differs from all.
+static optional<Difference> compare_data(shared_ptr<archive> reader,
+                                         const vector<fs::path>& paths,
+                                         Hasher* hasher, size_t& closest) {
+  thread_local static char buff[65536];  // read buffer, reused across calls
+
+  vector<int> fds;
+  vector<size_t> matching;  // files identical so far
+  for (size_t i = 0; i < paths.size(); i++) {
+    fds.push_back(open(paths[i].c_str(), O_RDONLY | O_CLOEXEC));
+    if (fds.back() >= 0) matching.push_back(i);
+  }
+  closest = matching.empty() ? 0 : matching.front();
+
+  optional<Difference> difference;
+  if (matching.empty()) difference = Difference{0};
+
+  int64_t expected = 0;
+  const void* block;
+  size_t len;
+  int64_t offset;
+  int r = ARCHIVE_OK;
+  while (!difference && (r = archive_read_data_block(reader.get(), &block,
+                                                     &len, &offset)) ==
+                            ARCHIVE_OK) {
+    vector<size_t> still_matching;
+    for (size_t i : matching) {
+      bool same = offset == expected;
+      for (size_t done = 0; same && done < len;) {
+        size_t n = min(len - done, sizeof(buff));
+        same = pread(fds[i], buff, n, offset + done) ==
+                   static_cast<ssize_t>(n) &&
+               memcmp(buff, static_cast<const char*>(block) + done, n) == 0;
+        done += n;
+      }
+      if (same) still_matching.push_back(i);
+    }
+
+    if (still_matching.empty()) {
+      closest = matching.front();
+      difference = Difference{expected, block, len, offset};
+      break;
+    }
+
+    matching.swap(still_matching);
+    closest = matching.front();
+    if (hasher) hasher->update(block, len);
+    expected = offset + len;
+  }
+  for (int fd : fds) {
+    if (fd >= 0) close(fd);
+  }
+
+  if (r != ARCHIVE_OK && r != ARCHIVE_EOF) {
+    throw XwimError{"Failed reading archive entry data. {}",
+                    archive_error_string(reader.get())};
+  }
+  return difference;
+}
+
+// Make the freshly created file at `path` share the data of `source`
+// copy-on-write. Returns false if the file system does not support it or
+// `source` is on another file system.
+static bool clone_file(const fs::path& source, const char* path) {
+#ifdef FICLONE
+  int src = open(source.c_str(), O_RDONLY | O_CLOEXEC);
+  if (src < 0) return false;
+  int dst = open(path, O_WRONLY | O_CLOEXEC);
+  bool cloned = dst >= 0 && ioctl(dst, FICLONE, src) == 0;
+  if (dst >= 0) close(dst);
+  close(src);
+  return cloned;
+#else
+  (void)source;
+  (void)path;
+  return false;
+#endif
+}
+
+// Write the first `len` bytes of the file at `path` as entry data to `writer`
+static void copy_prefix(shared_ptr<archive> writer, const fs::path& path,
+                        int64_t len) {
+  thread_local static char buff[65536];  // read buffer, reused across calls
+
+  int fd = open(path.c_str(), O_RDONLY | O_CLOEXEC);
+  if (fd < 0 && len > 0) {
+    throw XwimError{"Failed opening {}. {}", path, strerror(errno)};
+  }
+
+  for (int64_t offset = 0; offset < len;) {
+    ssize_t n = pread(fd, buff, min<int64_t>(len - offset, sizeof(buff)),
+                      offset);
+    if (n <= 0 || archive_write_data_block(writer.get(), buff, n, offset) !=
+                      ARCHIVE_OK) {
+      close(fd);
+      throw XwimError{"Failed copying {}", path};
+    }
+    offset += n;
+  }
+  if (fd >= 0) close(fd);
+}
+
+static void hash_file(const char* path, Hasher& hasher) {
+  thread_local static char buff[65536];  // read buffer, reused across calls
+
+  int fd = open(path, O_RDONLY | O_CLOEXEC);
+  if (fd < 0) {
+    throw XwimError{"Failed opening {}. {}", path, strerror(errno)};
+  }
+
+  hasher.reset();
+  ssize_t len;
+  while ((len = read(fd, buff, sizeof(buff))) > 0) hasher.update(buff, len);
+  int err = errno;
+  close(fd);
+
+  if (len < 0) throw XwimError{"Failed reading {}. {}", path, strerror(err)};
+}
+
+static void write_entry(shared_ptr<archive> writer, archive_entry* entry,
+                        Hasher* hasher, Manifest* manifest) {
+  thread_local static char buff[16384];  // read buffer, reused across calls
+
+  XWIM_LOG_DEBUG("Adding {} to archive", archive_entry_pathname(entry));
+  int r;
+  {
+    trace::Span span{"write_header", archive_entry_pathname(entry)};
+    r = archive_write_header(writer.get(), entry);
+  }
+  if (r != ARCHIVE_OK) {
+    throw XwimError{"Failed writing archive entry. {}",
+                    archive_error_string(writer.get())};
+  }
+
+  /* For now, we use a simpler loop to copy data
+   * into the target archive. */
+  bool hash = manifest && archive_entry_filetype(entry) == AE_IFREG;
+  if (hash) hasher->reset();
+
+  // Only regular files have data, opening a symlink would read its target
+  if (archive_entry_filetype(entry) != AE_IFREG) return;
+
+  trace::Span span{"copy_data", archive_entry_pathname(entry)};
+  const char* source = archive_entry_sourcepath(entry);
+  int fd = open(source, O_RDONLY | O_CLOEXEC);
+  if (fd < 0) {
+    throw XwimError{"Failed opening {}. {}", source, strerror(errno)};
+  }
+
+  ssize_t len;
+  while ((len = read(fd, buff, sizeof(buff))) > 0) {
+    if (hash) hasher->update(buff, len);
+    if (archive_write_data(writer.get(), buff, len) < 0) {
+      close(fd);
+      throw XwimError{"Failed writing {} to archive. {}", source,
+                      archive_error_string(writer.get())};
+    }
+  }
+  if (len < 0) {
+    int err = errno;
+    close(fd);
+    throw XwimError{"Failed reading {}. {}", source, strerror(err)};
+  }
+  close(fd);
+
+  if (hash) manifest->add(hasher->digest(), source);
+}
+
+// Physical offset of the first extent of `path` if the file system reports it
+static optional<uint64_t> physical_offset(const char* path) {
+#ifdef FS_IOC_FIEMAP
+  int fd = open(path, O_RDONLY);
+  if (fd < 0) return nullopt;
+
+  alignas(struct fiemap) char
+      buff[sizeof(struct fiemap) + sizeof(struct fiemap_extent)] = {};
+  struct fiemap* fm = reinterpret_cast<struct fiemap*>(buff);
+  fm->fm_length = FIEMAP_MAX_OFFSET;
+  fm->fm_extent_count = 1;
+
+  int r = ioctl(fd, FS_IOC_FIEMAP, fm);
+  close(fd);
+
+  if (r < 0 || fm->fm_mapped_extents == 0) return nullopt;
+  return fm->fm_extents[0].fe_physical;
+#else
+  (void)path;
+  return nullopt;
+#endif
+}
+
+template <typename Key>
+static void sort_by_key(vector<shared_ptr<archive_entry>>::iterator begin,
+                        vector<shared_ptr<archive_entry>>::iterator end,
+                        Key (*key_of)(archive_entry*)) {
+  vector<pair<Key, shared_ptr<archive_entry>>> keyed;
+  keyed.reserve(end - begin);
+  for (auto it = begin; it != end; ++it) {
+    keyed.emplace_back(key_of(it->get()), *it);
+  }
+
+  stable_sort(keyed.begin(), keyed.end(),
+              [](const auto& a, const auto& b) { return a.first < b.first; });
+
+  for (auto& k : keyed) *begin++ = k.second;
+}
+
+// Files the file system could locate first, in (device, extent) order. Others
+// follow in (device, inode) order.
+static tuple<bool, dev_t, uint64_t> locality_key(archive_entry* entry) {
+  optional<uint64_t> offset = physical_offset(archive_entry_sourcepath(entry));
+  if (offset) return {false, archive_entry_dev(entry), offset.value()};
+  return {true, archive_entry_dev(entry), archive_entry_ino64(entry)};
+}
+
+// Similar files next to each other so they share the compressor window
+static tuple<string, int64_t> type_key(archive_entry* entry) {
+  return {fs::path{archive_entry_pathname(entry)}.extension().string(),
+          archive_entry_size(entry)};
+}
+
+static void order_entries(vector<shared_ptr<archive_entry>>& entries,
+                          Ordering ordering) {
+  if (ordering == Ordering::LEXICAL) {
+    sort(entries.begin(), entries.end(), [](const auto& a, const auto& b) {
+      return strcmp(archive_entry_pathname(a.get()),
+                    archive_entry_pathname(b.get())) < 0;
+    });
+    return;
+  }
+
+  // Keep directories and other non-regular entries up front in walk order so
+  // parents still precede their content. Only file contents are reordered.
+  auto files = stable_partition(
+      entries.begin(), entries.end(),
+      [](const auto& e) { return archive_entry_filetype(e.get()) != AE_IFREG; });
+
+  switch (ordering) {
+    case Ordering::INODE:
+      sort_by_key(files, entries.end(), locality_key);
+      break;
+    case Ordering::TYPE:
+      sort_by_key(files, entries.end(), type_key);
+      break;
+    default:
+      break;
+  }
+}
+
 }  // namespace xwim
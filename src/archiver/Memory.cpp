@@ -0,0 +1,194 @@
+#include "Memory.hpp"
+
+#include <algorithm>
+#include <fstream>
+#include <optional>
+#include <string>
+
+#include "../Archiver.hpp"
+#include "../util/Parallel.hpp"
+#include "GzipReader.hpp"
+#include "ZipWriter.hpp"
+
+namespace xwim {
+using namespace std;
+namespace fs = std::filesystem;
+
+// Read blocks, tar layer and write buffers around every reader or writer
+static constexpr uint64_t io_memory = 1 << 20;
+// Decoder state besides the window
+static constexpr uint64_t decoder_state = 512 << 10;
+
+// Defaults for unreadable headers: xz and lzip at level 9, zstd at level 19
+static constexpr uint64_t default_lzma_dictionary = 64 << 20;
+static constexpr uint64_t default_zstd_window = 8 << 20;
+
+// libarchive's default levels: xz and lzip at 6 (8MiB dictionary, ~94MiB),
+// bzip2 at 9, zstd at 3
+static constexpr uint64_t lzma_encoder = 96 << 20;
+static constexpr uint64_t bzip2_encoder = 8 << 20;
+static constexpr uint64_t zstd_encoder = 8 << 20;
+static constexpr uint64_t deflate_encoder = 512 << 10;
+
+Buffers buffer_sizes(const Options& opts) {
+  Buffers buffers{GzipReader::default_whole_limit, 16 << 20, 0};
+  if (opts.memory_limit == 0) return buffers;
+
+  uint64_t limit = opts.memory_limit;
+  buffers.gzip_whole = min(buffers.gzip_whole, limit / 2);
+  buffers.convert_pipe = clamp<uint64_t>(limit / 8, 1 << 20,
+                                         buffers.convert_pipe);
+  buffers.zip_window = max<uint64_t>(limit / 2, zip::chunk_memory);
+  return buffers;
+}
+
+static uint64_t le(const string& b, size_t at, int n) {
+  uint64_t v = 0;
+  for (int i = n - 1; i >= 0; i--) v = (v << 8) | static_cast<uint8_t>(b[at + i]);
+  return v;
+}
+
+// Multibyte integer of xz headers, advances `at`
+static optional<uint64_t> xz_varint(const string& b, size_t& at) {
+  uint64_t v = 0;
+  for (int i = 0; i < 9 && at < b.size(); i++) {
+    uint8_t byte = b[at++];
+    v |= uint64_t{byte & 0x7fu} << (7 * i);
+    if (!(byte & 0x80)) return v;
+  }
+  return nullopt;
+}
+
+optional<uint64_t> xz_dictionary(const string& b) {
+  if (b.size() < 14 || b.compare(0, 6, "\xfd" "7zXZ\0", 6) != 0) {
+    return nullopt;
+  }
+
+  size_t at = 12;  // after the stream header
+  if (b[at] == 0) return 0;  // no blocks
+  size_t end = at + (static_cast<uint8_t>(b[at]) + 1) * 4;
+  uint8_t flags = b[at + 1];
+  at += 2;
+  if (end > b.size()) return nullopt;
+
+  if (flags & 0x40 && !xz_varint(b, at)) return nullopt;  // compressed size
+  if (flags & 0x80 && !xz_varint(b, at)) return nullopt;  // uncompressed size
+
+  for (int filter = 0; filter <= (flags & 0x03); filter++) {
+    auto id = xz_varint(b, at);
+    auto props = xz_varint(b, at);
+    if (!id || !props || at + props.value() > end) return nullopt;
+
+    if (id.value() == 0x21 && props.value() == 1) {  // LZMA2
+      unsigned bits = static_cast<uint8_t>(b[at]) & 0x3f;
+      if (bits > 40) return nullopt;
+      if (bits == 40) return 0xffffffff;
+      return uint64_t{2u | (bits & 1)} << (bits / 2 + 11);
+    }
+    at += props.value();
+  }
+  return nullopt;
+}
+
+optional<uint64_t> lzip_dictionary(const string& b) {
+  if (b.size() < 6 || b.compare(0, 4, "LZIP") != 0) return nullopt;
+
+  uint8_t coded = b[5];
+  uint64_t size = uint64_t{1} << (coded & 0x1f);
+  return size - (size / 16) * ((coded >> 5) & 0x07);
+}
+
+optional<uint64_t> zstd_window(const string& b) {
+  size_t at = 0;
+  while (at + 8 <= b.size() && (le(b, at, 4) & 0xfffffff0) == 0x184d2a50) {
+    at += 8 + le(b, at + 4, 4);
+  }
+  if (at + 6 > b.size() || le(b, at, 4) != 0xfd2fb528) return nullopt;
+
+  uint8_t descriptor = b[at + 4];
+  at += 5;
+  if (!(descriptor & 0x20)) {  // window descriptor present
+    uint8_t window = b[at];
+    uint64_t base = uint64_t{1} << (10 + (window >> 3));
+    return base + base / 8 * (window & 0x07);
+  }
+
+  // Single segment: the window is the content size
+  static const int dictionary_id_sizes[] = {0, 1, 2, 4};
+  static const int content_size_sizes[] = {1, 2, 4, 8};
+  at += dictionary_id_sizes[descriptor & 0x03];
+  int n = content_size_sizes[descriptor >> 6];
+  if (at + n > b.size()) return nullopt;
+  return le(b, at, n) + (n == 2 ? 256 : 0);
+}
+
+optional<uint64_t> bzip2_memory(const string& b) {
+  if (b.size() < 4 || b.compare(0, 3, "BZh") != 0 || b[3] < '1' ||
+      b[3] > '9') {
+    return nullopt;
+  }
+  return 100000 + 4 * 100000 * uint64_t(b[3] - '0');
+}
+
+uint64_t decoder_memory(const fs::path& path, const Options& opts) {
+  Format format = find_extension_format(archive_extension(path).string());
+
+  string head(4096, '\0');
+  ifstream in{path, ios::binary};
+  in.read(head.data(), head.size());
+  head.resize(in.gcount());
+
+  uint64_t decoder = decoder_state;
+  switch (format) {
+    case Format::TAR_GZIP:
+      decoder = GzipReader::memory(path, buffer_sizes(opts).gzip_whole);
+      break;
+    case Format::TAR_BZIP2:
+      decoder = bzip2_memory(head).value_or(bzip2_memory("BZh9").value());
+      break;
+    case Format::TAR_XZ:
+      decoder += xz_dictionary(head).value_or(default_lzma_dictionary);
+      break;
+    case Format::TAR_LZIP:
+      decoder += lzip_dictionary(head).value_or(default_lzma_dictionary);
+      break;
+    case Format::TAR_ZSTD:
+      decoder += zstd_window(head).value_or(default_zstd_window);
+      break;
+    default:
+      break;
+  }
+
+  return io_memory + decoder;
+}
+
+uint64_t encoder_memory(Format format, const Options& opts) {
+  uint64_t encoder = deflate_encoder;
+  switch (format) {
+    case Format::TAR_BZIP2:
+      encoder = bzip2_encoder;
+      break;
+    case Format::TAR_XZ:
+    case Format::TAR_LZIP:
+      encoder = lzma_encoder;
+      break;
+    case Format::TAR_ZSTD:
+      encoder = zstd_encoder;
+      break;
+    case Format::ZIP: {
+      unsigned workers = worker_count(opts.threads);
+      if (workers > 1) {
+        uint64_t window = workers * zip::chunks_per_worker * zip::chunk_memory;
+        uint64_t limit = buffer_sizes(opts).zip_window;
+        encoder = limit > 0 ? min(window, limit) : window;
+      }
+      break;
+    }
+    default:
+      break;
+  }
+
+  return io_memory + encoder;
+}
+
+}  // namespace xwim
@@ -0,0 +1,59 @@
+#pragma once
+
+#include <cstdint>
+#include <filesystem>
+#include <map>
+#include <optional>
+#include <set>
+#include <string>
+
+#include "../Formats.hpp"
+#include "../Xwim.hpp"
+
+namespace xwim {
+
+/**
+ * Buffer sizes of a single archive job, scaled down to fit
+ * `Options::memory_limit`.
+ */
+struct Buffers {
+  // One-go gzip decompression (`GzipReader`), output
+  uint64_t gzip_whole;
+  // Data decoded ahead of encoding when converting
+  uint64_t convert_pipe;
+  // Chunks in flight in the parallel zip writer, 0 for its default
+  uint64_t zip_window;
+};
+
+Buffers buffer_sizes(const Options& opts);
+
+/**
+ * Memory a reader needs to decode the archive at `path`, including buffers.
+ *
+ * The window of xz, lzip and zstd decoders is declared in the first
+ * stream, block or frame header, the block size of bzip2 in the stream
+ * header. Only these headers are read. If they cannot be read, the largest
+ * window xwim itself would write is assumed.
+ */
+uint64_t decoder_memory(const std::filesystem::path& path,
+                        const Options& opts);
+
+// Header parsers of `decoder_memory`. `head` holds the first bytes of the
+// archive, std::nullopt if it does not start with a readable header.
+
+// LZMA2 dictionary size from the filter flags of the first xz block header
+std::optional<uint64_t> xz_dictionary(const std::string& head);
+// Dictionary size from the lzip header
+std::optional<uint64_t> lzip_dictionary(const std::string& head);
+// Window of the first zstd frame, skippable frames are skipped
+std::optional<uint64_t> zstd_window(const std::string& head);
+// Memory of bzip2 decompression, 100k plus four bytes per block byte
+std::optional<uint64_t> bzip2_memory(const std::string& head);
+
+/**
+ * Memory a writer needs to encode `format` at the levels xwim uses,
+ * including buffers and `opts.threads` workers where the format uses them.
+ */
+uint64_t encoder_memory(Format format, const Options& opts);
+
+}  // namespace xwim
@@ -0,0 +1,141 @@
+#include "ZipIndex.hpp"
+
+#include <fstream>
+
+namespace xwim::zip {
+using namespace std;
+namespace fs = std::filesystem;
+
+static constexpr uint32_t eocd_signature = 0x06054b50;
+static constexpr uint32_t zip64_eocd_signature = 0x06064b50;
+static constexpr uint32_t zip64_locator_signature = 0x07064b50;
+static constexpr uint32_t central_signature = 0x02014b50;
+
+static constexpr size_t eocd_size = 22;
+static constexpr size_t zip64_locator_size = 20;
+static constexpr size_t zip64_eocd_size = 56;
+static constexpr size_t central_size = 46;
+static constexpr size_t max_comment_size = 0xffff;
+
+static uint64_t le(const char* p, int n) {
+  uint64_t v = 0;
+  for (int i = n - 1; i >= 0; i--) v = (v << 8) | static_cast<uint8_t>(p[i]);
+  return v;
+}
+
+static bool read_at(ifstream& in, uint64_t offset, string& buff, size_t n) {
+  buff.resize(n);
+  in.seekg(offset);
+  in.read(buff.data(), n);
+  return in.gcount() == static_cast<streamsize>(n);
+}
+
+optional<vector<CentralEntry>> read_central_directory(const fs::path& path) {
+  ifstream in{path, ios::binary};
+  if (!in) return nullopt;
+
+  in.seekg(0, ios::end);
+  uint64_t file_size = in.tellg();
+  if (file_size < eocd_size) return nullopt;
+
+  // The end of central directory record is followed by a variable length
+  // comment, search backwards for its signature
+  size_t tail_size = min<uint64_t>(file_size, eocd_size + max_comment_size);
+  uint64_t tail_offset = file_size - tail_size;
+  string tail;
+  if (!read_at(in, tail_offset, tail, tail_size)) return nullopt;
+
+  size_t eocd = string::npos;
+  for (size_t i = tail_size - eocd_size + 1; i-- > 0;) {
+    if (le(&tail[i], 4) == eocd_signature) {
+      eocd = i;
+      break;
+    }
+  }
+  if (eocd == string::npos) return nullopt;
+
+  uint64_t count = le(&tail[eocd + 10], 2);
+  uint64_t cd_size = le(&tail[eocd + 12], 4);
+  uint64_t cd_offset = le(&tail[eocd + 16], 4);
+
+  if (count == 0xffff || cd_size == 0xffffffff || cd_offset == 0xffffffff) {
+    uint64_t locator = tail_offset + eocd;
+    if (locator < zip64_locator_size) return nullopt;
+    locator -= zip64_locator_size;
+
+    string buff;
+    if (!read_at(in, locator, buff, zip64_locator_size)) return nullopt;
+    if (le(&buff[0], 4) != zip64_locator_signature) return nullopt;
+
+    uint64_t zip64_eocd = le(&buff[8], 8);
+    if (!read_at(in, zip64_eocd, buff, zip64_eocd_size)) return nullopt;
+    if (le(&buff[0], 4) != zip64_eocd_signature) return nullopt;
+
+    count = le(&buff[32], 8);
+    cd_size = le(&buff[40], 8);
+    cd_offset = le(&buff[48], 8);
+  }
+
+  if (cd_offset > file_size || cd_size > file_size - cd_offset) return nullopt;
+
+  // Every entry takes at least a central header, a larger count is corrupt
+  // and must not size the allocation below
+  if (count > cd_size / central_size) return nullopt;
+
+  string cd;
+  if (!read_at(in, cd_offset, cd, cd_size)) return nullopt;
+
+  vector<CentralEntry> entries;
+  entries.reserve(count);
+
+  size_t pos = 0;
+  for (uint64_t i = 0; i < count; i++) {
+    if (cd_size - pos < central_size) return nullopt;
+    const char* h = &cd[pos];
+    if (le(h, 4) != central_signature) return nullopt;
+
+    size_t name_len = le(h + 28, 2);
+    size_t extra_len = le(h + 30, 2);
+    size_t comment_len = le(h + 32, 2);
+    if (cd_size - pos < central_size + name_len + extra_len + comment_len) {
+      return nullopt;
+    }
+
+    CentralEntry entry{string{h + central_size, name_len}, le(h + 20, 4),
+                       le(h + 24, 4), le(h + 42, 4)};
+
+    // Zip64 extended information holds the values that did not fit, in
+    // fixed order but only if the corresponding field is saturated
+    const char* extra = h + central_size + name_len;
+    for (size_t e = 0; e + 4 <= extra_len;) {
+      uint64_t id = le(extra + e, 2);
+      size_t len = le(extra + e + 2, 2);
+      if (e + 4 + len > extra_len) break;
+
+      if (id == 0x0001) {
+        const char* f = extra + e + 4;
+        const char* f_end = f + len;
+        if (entry.uncompressed_size == 0xffffffff && f + 8 <= f_end) {
+          entry.uncompressed_size = le(f, 8);
+          f += 8;
+        }
+        if (entry.compressed_size == 0xffffffff && f + 8 <= f_end) {
+          entry.compressed_size = le(f, 8);
+          f += 8;
+        }
+        if (entry.local_header_offset == 0xffffffff && f + 8 <= f_end) {
+          entry.local_header_offset = le(f, 8);
+        }
+      }
+
+      e += 4 + len;
+    }
+
+    entries.push_back(std::move(entry));
+    pos += central_size + name_len + extra_len + comment_len;
+  }
+
+  return entries;
+}
+
+}  // namespace xwim::zip
@@ -0,0 +1,34 @@
+#pragma once
+
+#include <cstdint>
+#include <filesystem>
+#include <optional>
+#include <string>
+#include <vector>
+
+namespace xwim::zip {
+
+/**
+ * An entry of a zip central directory.
+ *
+ * Zip64 extra fields are resolved, i.e. sizes and offsets are the real values
+ * even for archives >4GiB.
+ */
+struct CentralEntry {
+  std::string name;
+  uint64_t compressed_size;
+  uint64_t uncompressed_size;
+  uint64_t local_header_offset;
+};
+
+/**
+ * Read the central directory of the zip archive at `path`.
+ *
+ * Only touches the end of the file, no entry data is read.
+ *
+ * @returns std::nullopt if `path` is not a readable zip archive
+ */
+std::optional<std::vector<CentralEntry>> read_central_directory(
+    const std::filesystem::path& path);
+
+}  // namespace xwim::zip
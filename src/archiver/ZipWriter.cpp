@@ -0,0 +1,561 @@
+#include "ZipWriter.hpp"
+
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <zlib.h>
+
+#ifdef XWIM_HAVE_LIBDEFLATE
+#include <libdeflate.h>
+#endif
+
+#include <algorithm>
+#include <cerrno>
+#include <condition_variable>
+#include <cstdio>
+#include <cstring>
+#include <ctime>
+#include <exception>
+#include <mutex>
+#include <string>
+#include <thread>
+
+#include "../util/Common.hpp"
+#include "../util/Hash.hpp"
+#include "../util/Log.hpp"
+#include "../util/Trace.hpp"
+
+namespace xwim::zip {
+using namespace std;
+namespace fs = std::filesystem;
+
+static constexpr uint32_t local_signature = 0x04034b50;
+static constexpr uint32_t central_signature = 0x02014b50;
+static constexpr uint32_t eocd_signature = 0x06054b50;
+static constexpr uint32_t zip64_eocd_signature = 0x06064b50;
+static constexpr uint32_t zip64_locator_signature = 0x07064b50;
+
+static constexpr uint16_t method_store = 0;
+static constexpr uint16_t method_deflate = 8;
+static constexpr uint16_t version_made_by = (3 << 8) | 45;  // unix, 4.5
+static constexpr uint16_t version_deflate = 20;
+static constexpr uint16_t version_zip64 = 45;
+
+// Values at or above are stored in zip64 extra fields
+static constexpr uint64_t zip64_limit = 0xffffffff;
+// Files from this size on get zip64 local headers. Deflate expands
+// incompressible data slightly, the compressed size must fit, too.
+static constexpr uint64_t zip64_local_limit = 0xf0000000;
+
+static constexpr size_t dictionary_size = 32768;
+
+// Little endian record builder
+class Bytes {
+ private:
+  string bytes;
+
+  Bytes& le(uint64_t v, int n) {
+    for (int i = 0; i < n; i++) this->bytes += static_cast<char>(v >> (8 * i));
+    return *this;
+  }
+
+ public:
+  Bytes& u16(uint16_t v) { return this->le(v, 2); }
+  Bytes& u32(uint32_t v) { return this->le(v, 4); }
+  Bytes& u64(uint64_t v) { return this->le(v, 8); }
+  Bytes& str(const string& s) {
+    this->bytes += s;
+    return *this;
+  }
+
+  const string& data() const { return this->bytes; }
+};
+
+// An entry of the archive
+struct Item {
+  archive_entry* entry;
+  string name;
+  uint16_t method = method_store;
+  bool zip64_local = false;
+  string inline_data;  // symlink target
+  size_t first_chunk = 0;
+  size_t chunks = 0;
+
+  // Known once written
+  uint64_t offset = 0;
+  uint32_t crc = 0;
+  uint64_t compressed_size = 0;
+  uint64_t size = 0;
+};
+
+// A slice of a regular file, deflated by a worker
+struct Chunk {
+  size_t item;
+  int64_t offset;
+  int64_t length;
+  bool last;
+
+  string data;   // deflated
+  string input;  // only kept for hashing
+  int64_t read = 0;
+  uint32_t crc = 0;
+  bool done = false;
+  exception_ptr error;
+};
+
+static void read_fully(int fd, char* buff, int64_t length, int64_t offset,
+                       int64_t& read) {
+  read = 0;
+  while (read < length) {
+    ssize_t n = pread(fd, buff + read, length - read, offset + read);
+    if (n < 0 && errno == EINTR) continue;
+    if (n <= 0) break;  // file shrunk, archive what is there
+    read += n;
+  }
+}
+
+#ifdef XWIM_HAVE_LIBDEFLATE
+// Deflate a file that fits a single chunk as one complete stream with
+// libdeflate, at zlib's default level. libdeflate has no sync flush, so
+// chunks of larger files are left to zlib.
+static void deflate_whole(Chunk& chunk, const char* path) {
+  // Compressors are costly to set up, every worker keeps one
+  thread_local unique_ptr<libdeflate_compressor,
+                          void (*)(libdeflate_compressor*)>
+      compressor{libdeflate_alloc_compressor(6), libdeflate_free_compressor};
+  if (!compressor) {
+    throw XwimError{"Failed initializing deflate for {}", path};
+  }
+
+  chunk.data.resize(
+      libdeflate_deflate_compress_bound(compressor.get(), chunk.read));
+  size_t n = libdeflate_deflate_compress(compressor.get(), chunk.input.data(),
+                                         chunk.read, chunk.data.data(),
+                                         chunk.data.size());
+  if (n == 0) throw XwimError{"Failed deflating {}", path};
+  chunk.data.resize(n);
+}
+#endif
+
+static void deflate_chunk(Chunk& chunk, const char* path, bool keep_input) {
+  int fd = open(path, O_RDONLY | O_CLOEXEC);
+  if (fd < 0) {
+    throw XwimError{"Failed opening {}. {}", path, strerror(errno)};
+  }
+
+  // Prime the window with the data preceding the chunk, so chunking costs
+  // (almost) no compression
+  string dictionary;
+  int64_t dictionary_read = 0;
+  if (chunk.offset > 0) {
+    int64_t n = min<int64_t>(dictionary_size, chunk.offset);
+    dictionary.resize(n);
+    read_fully(fd, dictionary.data(), n, chunk.offset - n, dictionary_read);
+  }
+
+  chunk.input.resize(chunk.length);
+  read_fully(fd, chunk.input.data(), chunk.length, chunk.offset, chunk.read);
+  close(fd);
+
+#ifdef XWIM_HAVE_LIBDEFLATE
+  chunk.crc = libdeflate_crc32(0, chunk.input.data(), chunk.read);
+  if (chunk.offset == 0 && chunk.last) {
+    deflate_whole(chunk, path);
+    if (!keep_input) string{}.swap(chunk.input);
+    return;
+  }
+#else
+  chunk.crc = crc32(0, reinterpret_cast<const Bytef*>(chunk.input.data()),
+                    chunk.read);
+#endif
+
+  z_stream zs{};
+  if (deflateInit2(&zs, Z_DEFAULT_COMPRESSION, Z_DEFLATED, -MAX_WBITS, 8,
+                   Z_DEFAULT_STRATEGY) != Z_OK) {
+    throw XwimError{"Failed initializing deflate for {}", path};
+  }
+  if (dictionary_read > 0) {
+    deflateSetDictionary(&zs, reinterpret_cast<Bytef*>(dictionary.data()),
+                         dictionary_read);
+  }
+
+  chunk.data.resize(deflateBound(&zs, chunk.read) + 16);
+  zs.next_in = reinterpret_cast<Bytef*>(chunk.input.data());
+  zs.avail_in = chunk.read;
+  zs.next_out = reinterpret_cast<Bytef*>(chunk.data.data());
+  zs.avail_out = chunk.data.size();
+
+  int flush = chunk.last ? Z_FINISH : Z_SYNC_FLUSH;
+  for (;;) {
+    int r = deflate(&zs, flush);
+    if (r == Z_STREAM_ERROR) {
+      deflateEnd(&zs);
+      throw XwimError{"Failed deflating {}", path};
+    }
+    if (r == Z_STREAM_END || (!chunk.last && zs.avail_out != 0)) break;
+
+    size_t used = zs.total_out;
+    chunk.data.resize(chunk.data.size() * 2);
+    zs.next_out = reinterpret_cast<Bytef*>(chunk.data.data() + used);
+    zs.avail_out = chunk.data.size() - used;
+  }
+  chunk.data.resize(zs.total_out);
+  deflateEnd(&zs);
+
+  if (!keep_input) string{}.swap(chunk.input);
+}
+
+static void dos_time(time_t mtime, uint16_t& time, uint16_t& date) {
+  struct tm tm;
+  localtime_r(&mtime, &tm);
+  if (tm.tm_year < 80) {  // DOS dates start at 1980
+    time = 0;
+    date = (1 << 5) | 1;
+    return;
+  }
+  time = (tm.tm_hour << 11) | (tm.tm_min << 5) | (tm.tm_sec / 2);
+  date = ((tm.tm_year - 80) << 9) | ((tm.tm_mon + 1) << 5) | tm.tm_mday;
+}
+
+// Extended timestamp (UT) and unix owner (ux) extra fields
+static string unix_extra(archive_entry* entry) {
+  return Bytes{}
+      .u16(0x5455)
+      .u16(5)
+      .str(string(1, '\x01'))
+      .u32(archive_entry_mtime(entry))
+      .u16(0x7875)
+      .u16(11)
+      .str(string(1, '\x01'))
+      .str(string(1, '\x04'))
+      .u32(archive_entry_uid(entry))
+      .str(string(1, '\x04'))
+      .u32(archive_entry_gid(entry))
+      .data();
+}
+
+static string local_header(const Item& item) {
+  uint16_t time, date;
+  dos_time(archive_entry_mtime(item.entry), time, date);
+
+  bool zip64 = item.zip64_local || item.offset >= zip64_limit;
+  string extra;
+  if (item.zip64_local) {
+    extra =
+        Bytes{}.u16(0x0001).u16(16).u64(item.size).u64(item.compressed_size)
+            .data();
+  }
+  extra += unix_extra(item.entry);
+
+  return Bytes{}
+      .u32(local_signature)
+      .u16(zip64 ? version_zip64 : version_deflate)
+      .u16(0)  // flags, names are stored as is like libarchive does
+      .u16(item.method)
+      .u16(time)
+      .u16(date)
+      .u32(item.crc)
+      .u32(item.zip64_local ? zip64_limit : item.compressed_size)
+      .u32(item.zip64_local ? zip64_limit : item.size)
+      .u16(item.name.size())
+      .u16(extra.size())
+      .str(item.name)
+      .str(extra)
+      .data();
+}
+
+static string central_header(const Item& item) {
+  uint16_t time, date;
+  dos_time(archive_entry_mtime(item.entry), time, date);
+
+  bool zip64 = item.zip64_local || item.offset >= zip64_limit;
+  Bytes zip64_fields;
+  if (item.size >= zip64_limit) zip64_fields.u64(item.size);
+  if (item.compressed_size >= zip64_limit) {
+    zip64_fields.u64(item.compressed_size);
+  }
+  if (item.offset >= zip64_limit) zip64_fields.u64(item.offset);
+
+  string extra;
+  if (!zip64_fields.data().empty()) {
+    extra = Bytes{}
+                .u16(0x0001)
+                .u16(zip64_fields.data().size())
+                .str(zip64_fields.data())
+                .data();
+  }
+  extra += unix_extra(item.entry);
+
+  uint32_t attributes = archive_entry_mode(item.entry) << 16;
+  if (archive_entry_filetype(item.entry) == AE_IFDIR) attributes |= 0x10;
+
+  return Bytes{}
+      .u32(central_signature)
+      .u16(version_made_by)
+      .u16(zip64 ? version_zip64 : version_deflate)
+      .u16(0)  // flags
+      .u16(item.method)
+      .u16(time)
+      .u16(date)
+      .u32(item.crc)
+      .u32(min(item.compressed_size, zip64_limit))
+      .u32(min(item.size, zip64_limit))
+      .u16(item.name.size())
+      .u16(extra.size())
+      .u16(0)  // comment length
+      .u16(0)  // disk number
+      .u16(0)  // internal attributes
+      .u32(attributes)
+      .u32(min(item.offset, zip64_limit))
+      .str(item.name)
+      .str(extra)
+      .data();
+}
+
+static string end_of_central_directory(uint64_t count, uint64_t cd_offset,
+                                       uint64_t cd_size) {
+  Bytes end;
+  if (count >= 0xffff || cd_offset >= zip64_limit || cd_size >= zip64_limit) {
+    uint64_t zip64_eocd = cd_offset + cd_size;
+    end.u32(zip64_eocd_signature)
+        .u64(44)  // size of the remaining record
+        .u16(version_made_by)
+        .u16(version_zip64)
+        .u32(0)  // disk number
+        .u32(0)  // disk with the central directory
+        .u64(count)
+        .u64(count)
+        .u64(cd_size)
+        .u64(cd_offset);
+    end.u32(zip64_locator_signature)
+        .u32(0)  // disk with the zip64 end of central directory
+        .u64(zip64_eocd)
+        .u32(1);  // number of disks
+  }
+
+  return end.u32(eocd_signature)
+      .u16(0)  // disk number
+      .u16(0)  // disk with the central directory
+      .u16(min<uint64_t>(count, 0xffff))
+      .u16(min<uint64_t>(count, 0xffff))
+      .u32(min(cd_size, zip64_limit))
+      .u32(min(cd_offset, zip64_limit))
+      .u16(0)  // comment length
+      .data();
+}
+
+// Plan items and chunks for `entries`
+static void plan(const vector<shared_ptr<archive_entry>>& entries,
+                 vector<Item>& items, vector<Chunk>& chunks) {
+  for (const auto& e : entries) {
+    Item item;
+    item.entry = e.get();
+    item.name = archive_entry_pathname(e.get());
+    item.name.erase(0, item.name.find_first_not_of('/'));
+
+    switch (archive_entry_filetype(e.get())) {
+      case AE_IFDIR:
+        if (item.name.empty()) continue;
+        if (item.name.back() != '/') item.name += '/';
+        break;
+      case AE_IFLNK:
+        item.inline_data = archive_entry_symlink(e.get());
+        break;
+      case AE_IFREG: {
+        int64_t size = archive_entry_size(e.get());
+        if (size == 0) break;
+        item.method = method_deflate;
+        item.zip64_local = static_cast<uint64_t>(size) >= zip64_local_limit;
+        item.first_chunk = chunks.size();
+        for (int64_t offset = 0; offset < size; offset += chunk_size) {
+          Chunk chunk;
+          chunk.item = items.size();
+          chunk.offset = offset;
+          chunk.length = min<int64_t>(chunk_size, size - offset);
+          chunk.last = offset + chunk.length >= size;
+          chunks.push_back(std::move(chunk));
+        }
+        item.chunks = chunks.size() - item.first_chunk;
+        break;
+      }
+      default:
+        log::warn("Skipping {}, file type not supported by zip",
+                  archive_entry_pathname(e.get()));
+        continue;
+    }
+
+    items.push_back(std::move(item));
+  }
+}
+
+void write_parallel(const fs::path& out,
+                    const vector<shared_ptr<archive_entry>>& entries,
+                    unsigned workers, Manifest* manifest,
+                    uint64_t memory) {
+  vector<Item> items;
+  vector<Chunk> chunks;
+  plan(entries, items, chunks);
+
+  mutex mutex;
+  condition_variable chunk_done;
+  condition_variable space;
+  size_t next = 0;      // chunk to deflate next
+  size_t written = 0;   // chunks written so far
+  bool stop = false;
+  size_t window = chunks_per_worker * max(1u, workers);
+  if (memory > 0) {
+    window = clamp<size_t>(memory / chunk_memory, 1, window);
+  }
+
+  auto work = [&] {
+    for (;;) {
+      size_t i;
+      {
+        unique_lock<std::mutex> lock{mutex};
+        space.wait(lock, [&] {
+          return stop || next >= chunks.size() || next < written + window;
+        });
+        if (stop || next >= chunks.size()) return;
+        i = next++;
+      }
+
+      Chunk& chunk = chunks[i];
+      archive_entry* entry = items[chunk.item].entry;
+      try {
+        trace::Span span{"deflate", archive_entry_pathname(entry)};
+        deflate_chunk(chunk, archive_entry_sourcepath(entry),
+                      manifest != nullptr);
+      } catch (...) {
+        chunk.error = current_exception();
+      }
+
+      {
+        lock_guard<std::mutex> lock{mutex};
+        chunk.done = true;
+      }
+      chunk_done.notify_one();
+    }
+  };
+
+  vector<thread> pool;
+  trace::Recorder* recorder = trace::current();
+  for (unsigned w = 0; w < max(1u, workers); w++) {
+    pool.emplace_back([&, recorder] {
+      trace::Attach attach{recorder};
+      work();
+    });
+  }
+  auto join = [&] {
+    {
+      lock_guard<std::mutex> lock{mutex};
+      stop = true;
+    }
+    space.notify_all();
+    for (auto& t : pool) t.join();
+    pool.clear();
+  };
+
+  std::FILE* file = nullptr;
+  try {
+    file = std::fopen(out.c_str(), "wb");
+    if (!file) {
+      throw XwimError{"Failed opening {}. {}", out, strerror(errno)};
+    }
+    std::setvbuf(file, nullptr, _IOFBF, 1 << 20);
+
+    uint64_t offset = 0;
+    auto write = [&](const string& data) {
+      if (!data.empty() &&
+          std::fwrite(data.data(), 1, data.size(), file) != data.size()) {
+        throw XwimError{"Failed writing {}. {}", out, strerror(errno)};
+      }
+      offset += data.size();
+    };
+
+    unique_ptr<Hasher> hasher;
+    if (manifest) hasher = make_unique<Hasher>(manifest->algorithm());
+
+    // Local headers of files spanning several chunks are written before
+    // their CRC and compressed size are known and patched in the end
+    vector<size_t> patches;
+
+    for (size_t i = 0; i < items.size(); i++) {
+      Item& item = items[i];
+      item.offset = offset;
+      bool is_file = archive_entry_filetype(item.entry) == AE_IFREG;
+      if (hasher && is_file) hasher->reset();
+
+      if (item.chunks == 0) {
+        item.crc = crc32(0, reinterpret_cast<const Bytef*>(item.inline_data.data()),
+                         item.inline_data.size());
+        item.size = item.compressed_size = item.inline_data.size();
+        write(local_header(item));
+        write(item.inline_data);
+      }
+
+      for (size_t k = 0; k < item.chunks; k++) {
+        Chunk& chunk = chunks[item.first_chunk + k];
+        {
+          trace::Span span{"wait_chunk"};
+          unique_lock<std::mutex> lock{mutex};
+          chunk_done.wait(lock, [&] { return chunk.done; });
+        }
+        if (chunk.error) rethrow_exception(chunk.error);
+
+        item.crc = k == 0 ? chunk.crc
+                          : crc32_combine(item.crc, chunk.crc, chunk.read);
+        item.size += chunk.read;
+        item.compressed_size += chunk.data.size();
+
+        if (k == 0) {
+          if (item.chunks > 1) patches.push_back(i);
+          write(local_header(item));
+        }
+        if (hasher) hasher->update(chunk.input.data(), chunk.read);
+        write(chunk.data);
+
+        string{}.swap(chunk.data);
+        string{}.swap(chunk.input);
+        {
+          lock_guard<std::mutex> lock{mutex};
+          written = item.first_chunk + k + 1;
+        }
+        space.notify_all();
+      }
+
+      if (hasher && is_file) {
+        manifest->add(hasher->digest(), archive_entry_sourcepath(item.entry));
+      }
+    }
+
+    join();
+
+    uint64_t cd_offset = offset;
+    for (const Item& item : items) write(central_header(item));
+    write(end_of_central_directory(items.size(), cd_offset,
+                                   offset - cd_offset));
+
+    if (std::fflush(file) != 0) {
+      throw XwimError{"Failed writing {}. {}", out, strerror(errno)};
+    }
+    for (size_t i : patches) {
+      string header = local_header(items[i]);
+      if (pwrite(fileno(file), header.data(), header.size(),
+                 items[i].offset) != static_cast<ssize_t>(header.size())) {
+        throw XwimError{"Failed writing {}. {}", out, strerror(errno)};
+      }
+    }
+
+    FILE* f = file;
+    file = nullptr;
+    if (std::fclose(f) != 0) {
+      throw XwimError{"Failed writing {}. {}", out, strerror(errno)};
+    }
+  } catch (...) {
+    join();
+    if (file) std::fclose(file);
+    throw;
+  }
+}
+
+}  // namespace xwim::zip
@@ -0,0 +1,47 @@
+#pragma once
+
+#include <archive_entry.h>
+
+#include <cstdint>
+#include <filesystem>
+#include <memory>
+#include <vector>
+
+#include "../util/Manifest.hpp"
+
+namespace xwim::zip {
+
+// Files are deflated in chunks of this size, so large files spread over
+// workers, too
+inline constexpr int64_t chunk_size = 1 << 20;
+// Memory a chunk in flight takes: its input, the deflated data and the
+// dictionary
+inline constexpr uint64_t chunk_memory = 2 * chunk_size + (32 << 10);
+// Chunks in flight per worker, unless limited by `memory`
+inline constexpr size_t chunks_per_worker = 4;
+
+/**
+ * Write `entries`, as read from disk, to the zip archive `out` in the given
+ * order.
+ *
+ * `workers` threads read and deflate file data in chunks. Chunks of a file
+ * are one deflate stream: every chunk but the last ends on a sync flush and
+ * is primed with the 32KiB preceding it, CRCs are combined. The calling
+ * thread writes headers, data and the central directory in order, so the
+ * archive does not depend on scheduling. At most a few chunks per worker are
+ * in flight at any time, fewer if they would take more than `memory` bytes
+ * (0 for no limit). Builds with libdeflate deflate files of a single chunk
+ * with it.
+ *
+ * Only directories, regular files and symlinks are supported, others are
+ * skipped with a warning. If given, `manifest` is fed the content of all
+ * regular files.
+ *
+ * @throws XwimError if reading an input or writing `out` fails
+ */
+void write_parallel(const std::filesystem::path& out,
+                    const std::vector<std::shared_ptr<archive_entry>>& entries,
+                    unsigned workers, Manifest* manifest,
+                    uint64_t memory = 0);
+
+}  // namespace xwim::zip
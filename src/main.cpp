@@ -1,26 +1,44 @@
+#include <fmt/core.h>
 #include <spdlog/common.h>
 #include <spdlog/spdlog.h>
 
 #include <cstdlib>
 #include <filesystem>
 
-#include "UserIntent.hpp"
 #include "UserOpt.hpp"
+#include "Xwim.hpp"
 #include "util/Common.hpp"
 #include "util/Log.hpp"
 
 using namespace xwim;
 using namespace std;
 
+static int run_main(const UserOpt& user_opt) {
+  try {
+    Result result = run(user_opt);
+
+    for (const Verification& v : result.verified) {
+      if (v.ok()) {
+        fmt::print("{}: OK\n", v.archive);
+      } else {
+        fmt::print(stderr, "{}: FAILED. {}\n", v.archive, v.error.value());
+      }
+    }
+
+    return result.ok() ? EXIT_SUCCESS : EXIT_FAILURE;
+  } catch (XwimError& e) {
+    spdlog::error(e.what());
+    return EXIT_FAILURE;
+  }
+}
+
 int main(int argc, char** argv) {
   log::init();
   UserOpt user_opt = UserOpt{argc, argv};
   log::init(user_opt.verbosity);
+  log::init_async();
 
-  try {
-    unique_ptr<UserIntent> user_intent = make_intent(user_opt);
-    user_intent->execute();
-  } catch (XwimError& e) {
-    spdlog::error(e.what());
-  }
+  int status = run_main(user_opt);
+  log::shutdown();
+  return status;
 }
\ No newline at end of file
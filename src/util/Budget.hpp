@@ -0,0 +1,74 @@
+#pragma once
+
+#include <condition_variable>
+#include <cstdint>
+#include <mutex>
+
+namespace xwim {
+
+/**
+ * Memory shared by concurrent archive jobs (`--memory-limit`).
+ *
+ * Jobs reserve their estimated footprint before they start and wait while it
+ * does not fit next to the jobs running. A job larger than the whole budget
+ * is admitted once it runs alone, so it delays others but never deadlocks. A
+ * limit of 0 admits everything at once.
+ */
+class MemoryBudget {
+ private:
+  std::mutex mutex;
+  std::condition_variable released;
+  uint64_t limit;
+  uint64_t used = 0;
+
+ public:
+  explicit MemoryBudget(uint64_t limit) : limit(limit) {}
+
+  MemoryBudget(const MemoryBudget&) = delete;
+  MemoryBudget& operator=(const MemoryBudget&) = delete;
+
+  uint64_t capacity() const { return this->limit; }
+
+  // Wait until `bytes` fit into the budget and take them
+  void acquire(uint64_t bytes) {
+    if (this->limit == 0) return;
+
+    std::unique_lock<std::mutex> lock{this->mutex};
+    this->released.wait(lock, [&] {
+      return this->used == 0 || this->used + bytes <= this->limit;
+    });
+    this->used += bytes;
+  }
+
+  void release(uint64_t bytes) {
+    if (this->limit == 0) return;
+
+    {
+      std::lock_guard<std::mutex> lock{this->mutex};
+      this->used -= bytes;
+    }
+    this->released.notify_all();
+  }
+};
+
+/**
+ * Holds `bytes` of a `MemoryBudget` from construction to destruction.
+ */
+class Reservation {
+ private:
+  MemoryBudget& budget;
+  uint64_t bytes;
+
+ public:
+  Reservation(MemoryBudget& budget, uint64_t bytes)
+      : budget(budget), bytes(bytes) {
+    this->budget.acquire(bytes);
+  }
+
+  ~Reservation() { this->budget.release(this->bytes); }
+
+  Reservation(const Reservation&) = delete;
+  Reservation& operator=(const Reservation&) = delete;
+};
+
+}  // namespace xwim
@@ -5,13 +5,14 @@
 #include <string>
 #include <random>
 
+// Formats the native path string as is, without copying it or parsing it as
+// a format string
 template <>
-struct fmt::formatter<std::filesystem::path> {
-  constexpr auto parse(format_parse_context& ctx) { return ctx.begin(); }
-
+struct fmt::formatter<std::filesystem::path>
+    : fmt::formatter<fmt::string_view> {
   template <typename FormatContext>
   auto format(const std::filesystem::path& path, FormatContext& ctx) {
-    return format_to(ctx.out(), path.string());
+    return fmt::formatter<fmt::string_view>::format(path.native(), ctx);
   }
 };
 
@@ -0,0 +1,124 @@
+#include "Hash.hpp"
+
+#include <fmt/core.h>
+#include <xxhash.h>
+
+#ifdef XWIM_HAVE_LIBCRYPTO
+#include <openssl/evp.h>
+#endif
+
+#include <algorithm>
+
+#include "Common.hpp"
+
+namespace xwim {
+
+struct Hasher::State {
+  HashAlgorithm algorithm;
+  XXH3_state_t* xxh3 = nullptr;
+#ifdef XWIM_HAVE_LIBCRYPTO
+  EVP_MD_CTX* sha256 = nullptr;
+#endif
+};
+
+void Hasher::check(HashAlgorithm algorithm) {
+#ifndef XWIM_HAVE_LIBCRYPTO
+  if (algorithm == HashAlgorithm::SHA256) {
+    throw XwimError{"xwim was built without SHA-256 support (libcrypto)"};
+  }
+#else
+  (void)algorithm;
+#endif
+}
+
+Hasher::Hasher(HashAlgorithm algorithm) : state(std::make_unique<State>()) {
+  check(algorithm);
+  this->state->algorithm = algorithm;
+
+  switch (algorithm) {
+    case HashAlgorithm::XXH3:
+      this->state->xxh3 = XXH3_createState();
+      break;
+    case HashAlgorithm::SHA256:
+#ifdef XWIM_HAVE_LIBCRYPTO
+      this->state->sha256 = EVP_MD_CTX_new();
+#endif
+      break;
+  }
+
+  this->reset();
+}
+
+Hasher::~Hasher() {
+  if (this->state->xxh3) XXH3_freeState(this->state->xxh3);
+#ifdef XWIM_HAVE_LIBCRYPTO
+  if (this->state->sha256) EVP_MD_CTX_free(this->state->sha256);
+#endif
+}
+
+void Hasher::reset() {
+  switch (this->state->algorithm) {
+    case HashAlgorithm::XXH3:
+      XXH3_128bits_reset(this->state->xxh3);
+      break;
+    case HashAlgorithm::SHA256:
+#ifdef XWIM_HAVE_LIBCRYPTO
+      EVP_DigestInit_ex(this->state->sha256, EVP_sha256(), nullptr);
+#endif
+      break;
+  }
+}
+
+void Hasher::update(const void* data, size_t size) {
+  switch (this->state->algorithm) {
+    case HashAlgorithm::XXH3:
+      XXH3_128bits_update(this->state->xxh3, data, size);
+      break;
+    case HashAlgorithm::SHA256:
+#ifdef XWIM_HAVE_LIBCRYPTO
+      EVP_DigestUpdate(this->state->sha256, data, size);
+#endif
+      break;
+  }
+}
+
+void Hasher::update_zeros(size_t size) {
+  static const char zeros[16384] = {};
+  while (size > 0) {
+    size_t n = std::min(size, sizeof(zeros));
+    this->update(zeros, n);
+    size -= n;
+  }
+}
+
+static std::string hex(const unsigned char* data, size_t size) {
+  std::string out;
+  out.reserve(2 * size);
+  for (size_t i = 0; i < size; i++) out += fmt::format("{:02x}", data[i]);
+  return out;
+}
+
+std::string Hasher::digest() {
+  switch (this->state->algorithm) {
+    case HashAlgorithm::XXH3: {
+      XXH128_canonical_t canonical;
+      XXH128_canonicalFromHash(&canonical,
+                               XXH3_128bits_digest(this->state->xxh3));
+      return hex(canonical.digest, sizeof(canonical.digest));
+    }
+    case HashAlgorithm::SHA256: {
+#ifdef XWIM_HAVE_LIBCRYPTO
+      unsigned char md[EVP_MAX_MD_SIZE];
+      unsigned int md_len = 0;
+      EVP_DigestFinal_ex(this->state->sha256, md, &md_len);
+      return hex(md, md_len);
+#else
+      break;
+#endif
+    }
+  }
+
+  return {};
+}
+
+}  // namespace xwim
@@ -0,0 +1,43 @@
+#pragma once
+
+#include <cstddef>
+#include <memory>
+#include <string>
+
+#include "../Xwim.hpp"
+
+namespace xwim {
+
+/**
+ * Incremental content hash.
+ *
+ * Feed data with `update` in order, then get the hex digest with `digest`.
+ * The digests are compatible with `xxh128sum` and `sha256sum` respectively.
+ */
+class Hasher {
+ private:
+  struct State;
+  std::unique_ptr<State> state;
+
+ public:
+  explicit Hasher(HashAlgorithm algorithm);
+  ~Hasher();
+
+  // Throws `XwimError` if xwim was built without support for `algorithm`
+  static void check(HashAlgorithm algorithm);
+
+  Hasher(const Hasher&) = delete;
+  Hasher& operator=(const Hasher&) = delete;
+
+  void update(const void* data, size_t size);
+
+  // Feed `size` zero bytes, e.g. for holes in sparse files
+  void update_zeros(size_t size);
+
+  // Hex digest of all data fed since construction or the last `reset`
+  std::string digest();
+
+  void reset();
+};
+
+}  // namespace xwim
@@ -0,0 +1,107 @@
+#include "Log.hpp"
+
+#include <spdlog/async.h>
+#include <spdlog/common.h>
+#include <spdlog/sinks/stdout_color_sinks.h>
+#include <spdlog/spdlog.h>
+
+#include <cstdlib>
+
+namespace xwim::log {
+
+// Messages queued for the async logger before the oldest are dropped
+static constexpr size_t async_queue_size = 8192;
+
+static std::shared_ptr<spdlog::logger> lib_logger = [] {
+  auto logger = std::make_shared<spdlog::logger>("xwim");
+  logger->set_level(spdlog::level::off);
+  return logger;
+}();
+
+const std::shared_ptr<spdlog::logger>& logger() { return lib_logger; }
+
+void set_logger(std::shared_ptr<spdlog::logger> logger) {
+  lib_logger = std::move(logger);
+}
+
+spdlog::level::level_enum _init_from_env() {
+  char* env_lvl = std::getenv("XWIM_LOGLEVEL");
+  if (!env_lvl) {
+    return spdlog::level::level_enum::off;
+  }
+
+  spdlog::level::level_enum lvl = spdlog::level::from_str(env_lvl);
+
+  //`::from_str` returns `off` if no match found
+  if (spdlog::level::level_enum::off == lvl) {
+    spdlog::debug("No environment definition for log level");  // uses default
+                                                               // logger/level
+  }
+
+  return lvl;
+}
+
+spdlog::level::level_enum _init_from_compile() {
+  return static_cast<spdlog::level::level_enum>(XWIM_LOGLEVEL);
+}
+
+static void _set_level(spdlog::level::level_enum level) {
+  spdlog::set_level(level);
+  set_logger(spdlog::default_logger());
+}
+
+void init_async() {
+  if (spdlog::get_level() == spdlog::level::off ||
+      std::dynamic_pointer_cast<spdlog::async_logger>(
+          spdlog::default_logger())) {
+    return;
+  }
+
+  // Same sink as the synchronous default logger, behind a queue
+  spdlog::init_thread_pool(async_queue_size, 1);
+  auto sink = std::make_shared<spdlog::sinks::stdout_color_sink_mt>();
+  auto logger = std::make_shared<spdlog::async_logger>(
+      "", sink, spdlog::thread_pool(),
+      spdlog::async_overflow_policy::overrun_oldest);
+  logger->set_level(spdlog::get_level());
+  spdlog::set_default_logger(logger);
+  set_logger(logger);
+}
+
+void init(int verbosity, spdlog::level::level_enum level) {
+  if (verbosity != -1) {
+    switch (verbosity) {
+      case 0:
+        _set_level(spdlog::level::off);
+        break;
+      case 1:
+        _set_level(spdlog::level::info);
+        break;
+      case 2:
+        _set_level(spdlog::level::debug);
+        break;
+      case 3:
+      default:
+        _set_level(spdlog::level::trace);
+        break;
+    }
+    return;
+  }
+
+  if (spdlog::level::level_enum::off != level) {
+    _set_level(level);
+    return;
+  }
+
+  level = _init_from_env();
+  if (spdlog::level::level_enum::off != level) {
+    _set_level(level);
+    return;
+  }
+
+  _set_level(_init_from_compile());
+}
+
+void shutdown() { spdlog::shutdown(); }
+
+}  // namespace xwim::log
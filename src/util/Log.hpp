@@ -2,7 +2,8 @@
 #include <spdlog/common.h>
 #include <spdlog/spdlog.h>
 
-#include <cstdlib>
+#include <memory>
+#include <utility>
 #ifdef NDEBUG
 #define XWIM_LOGLEVEL SPDLOG_LEVEL_ERROR
 #else
@@ -12,37 +13,67 @@
 namespace xwim::log {
 
 /**
- * Get log level from XWIM_LOGLEVEL environment variable.
- * For valid values see SPDLOG_LEVEL_NAMES in spdlog/common.h
+ * The logger used by libxwim.
  *
- * @returns spdlog::level::level_enum::off if no valid XWIM_LOGLEVEL defined
+ * Defaults to a logger without sinks so that embedding xwim does not produce
+ * any output. The xwim executable installs the spdlog default logger via
+ * `init`.
+ */
+const std::shared_ptr<spdlog::logger>& logger();
+
+/**
+ * Replace the logger used by libxwim.
+ *
+ * Not thread-safe. Call before running any intents.
+ */
+void set_logger(std::shared_ptr<spdlog::logger> logger);
+
+/**
+ * Log from hot paths, e.g. once per archive entry.
+ *
+ * Calls below `SPDLOG_ACTIVE_LEVEL` are removed at compile time, arguments
+ * included. meson.build sets it to info for release builds.
  */
-spdlog::level::level_enum _init_from_env() {
-  char* env_lvl = std::getenv("XWIM_LOGLEVEL");
-  if (!env_lvl) {
-    return spdlog::level::level_enum::off;
-  }
+#define XWIM_LOG_TRACE(...) \
+  SPDLOG_LOGGER_TRACE(::xwim::log::logger(), __VA_ARGS__)
+#define XWIM_LOG_DEBUG(...) \
+  SPDLOG_LOGGER_DEBUG(::xwim::log::logger(), __VA_ARGS__)
+
+template <typename... Args>
+void trace(spdlog::format_string_t<Args...> fmt, Args&&... args) {
+  logger()->trace(fmt, std::forward<Args>(args)...);
+}
 
-  spdlog::level::level_enum lvl = spdlog::level::from_str(env_lvl);
+template <typename... Args>
+void debug(spdlog::format_string_t<Args...> fmt, Args&&... args) {
+  logger()->debug(fmt, std::forward<Args>(args)...);
+}
 
-  //`::from_str` returns `off` if no match found
-  if (spdlog::level::level_enum::off == lvl) {
-    spdlog::debug("No environment definition for log level");  // uses default
-                                                               // logger/level
-  }
+template <typename... Args>
+void info(spdlog::format_string_t<Args...> fmt, Args&&... args) {
+  logger()->info(fmt, std::forward<Args>(args)...);
+}
 
-  return lvl;
+template <typename... Args>
+void warn(spdlog::format_string_t<Args...> fmt, Args&&... args) {
+  logger()->warn(fmt, std::forward<Args>(args)...);
 }
 
+/**
+ * Get log level from XWIM_LOGLEVEL environment variable.
+ * For valid values see SPDLOG_LEVEL_NAMES in spdlog/common.h
+ *
+ * @returns spdlog::level::level_enum::off if no valid XWIM_LOGLEVEL defined
+ */
+spdlog::level::level_enum _init_from_env();
+
 /**
  * Get log level from compile time definition.
  *
  * @return spdlog::level::level_enum::error for release builds (-DNDEBUG)
  *         spdlog::level::level_enum::debug for debug builds
  */
-spdlog::level::level_enum _init_from_compile() {
-  return static_cast<spdlog::level::level_enum>(XWIM_LOGLEVEL);
-}
+spdlog::level::level_enum _init_from_compile();
 
 /**
  * Determine the log level from various sources at runtime.
@@ -56,41 +87,26 @@ spdlog::level::level_enum _init_from_compile() {
  *      -> DEBUG for debug builds
  *
  * The determined level is then set for the default logger via
- * `spdlog::set_level`.
+ * `spdlog::set_level`. The default logger is installed as libxwim logger.
  */
 void init(int verbosity = -1,
-          spdlog::level::level_enum level = spdlog::level::level_enum::off) {
-  if (verbosity != -1) {
-    switch (verbosity) {
-      case 0:
-        spdlog::set_level(spdlog::level::off);
-        break;
-      case 1:
-        spdlog::set_level(spdlog::level::info);
-        break;
-      case 2:
-        spdlog::set_level(spdlog::level::debug);
-        break;
-      case 3:
-      default:
-        spdlog::set_level(spdlog::level::trace);
-        break;
-    }
-    return;
-  }
-
-  if (spdlog::level::level_enum::off != level) {
-    spdlog::set_level(level);
-    return;
-  }
+          spdlog::level::level_enum level = spdlog::level::level_enum::off);
 
-  level = _init_from_env();
-  if (spdlog::level::level_enum::off != level) {
-    spdlog::set_level(level);
-    return;
-  }
+/**
+ * Replace the default logger by an async logger, unless logging is off.
+ *
+ * Messages are queued in a bounded queue and written by a background thread,
+ * so I/O threads never block on the console. If the queue is full the oldest
+ * messages are dropped. Call once the final level is set with `init`, no
+ * thread is started if nothing is logged.
+ */
+void init_async();
 
-  spdlog::set_level(_init_from_compile());
-}
+/**
+ * Flush queued messages and stop the background thread of the async logger.
+ *
+ * Call before exiting, messages still queued are lost otherwise.
+ */
+void shutdown();
 
 }  // namespace xwim::log
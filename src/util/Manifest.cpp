@@ -0,0 +1,149 @@
+#include "Manifest.hpp"
+
+#include <fmt/core.h>
+#include <unistd.h>
+
+#include <cerrno>
+#include <cstdlib>
+#include <cstring>
+#include <memory>
+
+#include "Common.hpp"
+#include "Hash.hpp"
+
+namespace xwim {
+namespace fs = std::filesystem;
+
+Manifest::Manifest(const fs::path& path, HashAlgorithm algorithm)
+    : path(path), base(fs::current_path()), hash_algorithm(algorithm) {
+  Hasher::check(algorithm);
+
+  this->file = std::fopen(path.c_str(), "w");
+  if (!this->file) {
+    throw XwimError{"Failed opening manifest {}. {}", path,
+                    std::strerror(errno)};
+  }
+}
+
+Manifest::~Manifest() {
+  if (this->file) std::fclose(this->file);
+}
+
+fs::path Manifest::relative(const fs::path& p) const {
+  if (p.is_absolute()) return p.lexically_proximate(this->base);
+  return p.lexically_normal();
+}
+
+// The path of a manifest line as `sha256sum -c` reads it back
+static std::string escape(const std::string& name) {
+  std::string escaped;
+  for (char c : name) {
+    if (c == '\\') {
+      escaped += "\\\\";
+    } else if (c == '\n') {
+      escaped += "\\n";
+    } else {
+      escaped += c;
+    }
+  }
+  return escaped;
+}
+
+static std::string unescape(const std::string& escaped) {
+  std::string name;
+  for (size_t i = 0; i < escaped.size(); i++) {
+    if (escaped[i] == '\\' && i + 1 < escaped.size()) {
+      name += escaped[++i] == 'n' ? '\n' : escaped[i];
+    } else {
+      name += escaped[i];
+    }
+  }
+  return name;
+}
+
+static void print_line(std::FILE* file, const std::string& digest,
+                       const std::string& name) {
+  std::string escaped = escape(name);
+  fmt::print(file, "{}{}  {}\n", escaped.size() != name.size() ? "\\" : "",
+             digest, escaped);
+}
+
+void Manifest::add(const std::string& digest, const fs::path& path) {
+  std::string name = this->relative(path).string();
+  std::lock_guard<std::mutex> lock{this->mutex};
+  print_line(this->file, digest, name);
+}
+
+uint64_t Manifest::end() {
+  std::lock_guard<std::mutex> lock{this->mutex};
+  return std::ftell(this->file);
+}
+
+// Whether `p` is `dir` or below it, both in normal form
+static bool is_below(const fs::path& p, const fs::path& dir) {
+  auto it = p.begin();
+  for (const fs::path& d : dir) {
+    if (d.empty()) continue;  // trailing separator
+    if (it == p.end() || *it != d) return false;
+    ++it;
+  }
+  return true;
+}
+
+void Manifest::relocate(uint64_t start, const fs::path& from,
+                        const fs::path& to) {
+  fs::path rel_from = this->relative(from);
+  fs::path rel_to = this->relative(to);
+
+  std::lock_guard<std::mutex> lock{this->mutex};
+  std::fflush(this->file);
+
+  // Lines are read ahead of where they are written back, they only shrink
+  std::unique_ptr<std::FILE, int (*)(std::FILE*)> in{
+      std::fopen(this->path.c_str(), "r"), std::fclose};
+  if (!in || std::fseek(in.get(), start, SEEK_SET) != 0 ||
+      std::fseek(this->file, start, SEEK_SET) != 0) {
+    throw XwimError{"Failed rewriting manifest {}. {}", this->path,
+                    std::strerror(errno)};
+  }
+
+  char* line = nullptr;
+  size_t capacity = 0;
+  ssize_t len;
+  while ((len = getline(&line, &capacity, in.get())) > 0) {
+    std::string l{line, static_cast<size_t>(len)};
+    if (l.back() == '\n') l.pop_back();
+
+    bool escaped = !l.empty() && l[0] == '\\';
+    if (escaped) l.erase(0, 1);
+    size_t sep = l.find("  ");
+    if (sep == std::string::npos) continue;
+
+    std::string digest = l.substr(0, sep);
+    fs::path name = l.substr(sep + 2);
+    if (escaped) name = unescape(name.string());
+
+    if (is_below(name, rel_from)) {
+      name = (rel_to / name.lexically_relative(rel_from)).lexically_normal();
+    }
+    print_line(this->file, digest, name.string());
+  }
+  std::free(line);
+
+  std::fflush(this->file);
+  if (ftruncate(fileno(this->file), std::ftell(this->file)) != 0) {
+    throw XwimError{"Failed rewriting manifest {}. {}", this->path,
+                    std::strerror(errno)};
+  }
+}
+
+void Manifest::close() {
+  std::lock_guard<std::mutex> lock{this->mutex};
+  bool failed = std::ferror(this->file) != 0;
+  failed |= std::fclose(this->file) != 0;
+  this->file = nullptr;
+
+  if (failed) throw XwimError{"Failed writing manifest"};
+}
+
+}  // namespace xwim
@@ -0,0 +1,61 @@
+#pragma once
+
+#include <cstdint>
+#include <cstdio>
+#include <filesystem>
+#include <mutex>
+#include <string>
+
+#include "../Xwim.hpp"
+
+namespace xwim {
+
+/**
+ * Checksum manifest written alongside extraction, compression or conversion.
+ *
+ * One line per regular file in the format of `sha256sum`/`xxh128sum`, i.e.
+ * `<hex digest>  <path>`. Like coreutils, a path containing a backslash or
+ * newline is escaped as `\\` and `\n` and its line starts with `\`.
+ *
+ * Extracted and compressed files are listed where they are on disk, relative
+ * to the working directory the manifest was created in, so `-c` run there
+ * checks them. Converted entries never touch the disk, they are listed by
+ * their name in the archive. Adding lines is thread-safe.
+ */
+class Manifest {
+ private:
+  std::filesystem::path path;
+  std::filesystem::path base;  // working directory at creation
+  std::FILE* file;
+  std::mutex mutex;
+  HashAlgorithm hash_algorithm;
+
+  std::filesystem::path relative(const std::filesystem::path& p) const;
+
+ public:
+  // Throws `XwimError` if `algorithm` is not supported, before `path` is
+  // truncated
+  Manifest(const std::filesystem::path& path, HashAlgorithm algorithm);
+  ~Manifest();
+
+  Manifest(const Manifest&) = delete;
+  Manifest& operator=(const Manifest&) = delete;
+
+  HashAlgorithm algorithm() const { return this->hash_algorithm; }
+
+  void add(const std::string& digest, const std::filesystem::path& path);
+
+  // Offset of the next line, marks the start of the lines `relocate` rewrites
+  uint64_t end();
+
+  // Rewrite the paths below `from` in the lines added since `start` to below
+  // `to` after their files were moved there. `to` must be a parent of
+  // `from`, lines only get shorter and are rewritten in place.
+  void relocate(uint64_t start, const std::filesystem::path& from,
+                const std::filesystem::path& to);
+
+  // Flush and close the manifest, throws `XwimError` if writing failed
+  void close();
+};
+
+}  // namespace xwim
@@ -0,0 +1,65 @@
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <cstddef>
+#include <exception>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include "Trace.hpp"
+
+namespace xwim {
+
+/**
+ * Number of workers to use for a requested number of `threads`.
+ *
+ * @returns one worker per core if `threads` is 0, `threads` otherwise
+ */
+inline unsigned worker_count(unsigned threads) {
+  if (threads != 0) return threads;
+  return std::max(1u, std::thread::hardware_concurrency());
+}
+
+/**
+ * Call `fn(i)` for every `i` in `[0, n)` on up to `threads` threads.
+ *
+ * Work is handed out dynamically so uneven items balance across workers. The
+ * calling thread is one of the workers. If `fn` throws, remaining items are
+ * abandoned and the first exception is rethrown once all workers stopped.
+ */
+template <typename Fn>
+void parallel_for(size_t n, unsigned threads, Fn fn) {
+  std::atomic<size_t> next{0};
+  std::exception_ptr error;
+  std::mutex error_mutex;
+
+  auto work = [&] {
+    for (size_t i = next++; i < n; i = next++) {
+      try {
+        fn(i);
+      } catch (...) {
+        std::lock_guard<std::mutex> lock{error_mutex};
+        if (!error) error = std::current_exception();
+        next = n;
+      }
+    }
+  };
+
+  size_t workers = std::min<size_t>(std::max(1u, threads), n);
+  std::vector<std::thread> pool;
+  trace::Recorder* recorder = trace::current();
+  for (size_t w = 1; w < workers; w++) {
+    pool.emplace_back([&, recorder] {
+      trace::Attach attach{recorder};
+      work();
+    });
+  }
+  work();
+  for (auto& t : pool) t.join();
+
+  if (error) std::rethrow_exception(error);
+}
+
+}  // namespace xwim
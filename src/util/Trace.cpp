@@ -0,0 +1,119 @@
+#include "Trace.hpp"
+
+#include <fmt/core.h>
+#include <unistd.h>
+
+#include <atomic>
+#include <cerrno>
+#include <cstdio>
+#include <cstring>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+#include "Common.hpp"
+
+namespace xwim::trace {
+
+namespace {
+struct Event {
+  const char* name;
+  std::string detail;
+  int64_t start_us;
+  int64_t end_us;
+};
+}  // namespace
+
+struct Recorder::Buffer {
+  uint32_t tid;
+  std::vector<Event> events;
+};
+
+// Recorders are told apart by id, a new one may reuse the address of an old
+static std::atomic<uint64_t> next_recorder_id{1};
+
+Recorder::Recorder() : id(next_recorder_id++), epoch_us(now_us()) {}
+
+Recorder::~Recorder() = default;
+
+Recorder::Buffer& Recorder::local_buffer() {
+  thread_local uint64_t owner = 0;
+  thread_local Buffer* buffer = nullptr;
+  if (owner != this->id) {
+    std::lock_guard<std::mutex> lock{this->buffers_mutex};
+    this->buffers.push_back(std::make_unique<Buffer>());
+    buffer = this->buffers.back().get();
+    buffer->tid = this->buffers.size();
+    buffer->events.reserve(1024);
+    owner = this->id;
+  }
+  return *buffer;
+}
+
+void Recorder::record(const char* name, std::string detail, int64_t start_us,
+                      int64_t end_us) {
+  local_buffer().events.push_back(
+      Event{name, std::move(detail), start_us, end_us});
+}
+
+static std::string escape(const std::string& s) {
+  std::string out;
+  out.reserve(s.size());
+  for (unsigned char c : s) {
+    switch (c) {
+      case '"':
+        out += "\\\"";
+        break;
+      case '\\':
+        out += "\\\\";
+        break;
+      default:
+        if (c < 0x20) {
+          out += fmt::format("\\u{:04x}", c);
+        } else {
+          out += c;
+        }
+    }
+  }
+  return out;
+}
+
+void Recorder::write(const std::filesystem::path& path) {
+  std::FILE* file = std::fopen(path.c_str(), "w");
+  if (!file) {
+    throw XwimError{"Failed opening trace {}. {}", path, std::strerror(errno)};
+  }
+
+  std::lock_guard<std::mutex> lock{this->buffers_mutex};
+  int pid = getpid();
+  const char* sep = "";
+
+  fmt::print(file, "{{\"displayTimeUnit\":\"ms\",\"traceEvents\":[");
+  for (auto& buffer : this->buffers) {
+    fmt::print(file,
+               "{}\n{{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":{},"
+               "\"tid\":{},\"args\":{{\"name\":\"xwim-{}\"}}}}",
+               sep, pid, buffer->tid, buffer->tid);
+    sep = ",";
+
+    for (const Event& e : buffer->events) {
+      fmt::print(file,
+                 ",\n{{\"name\":\"{}\",\"cat\":\"xwim\",\"ph\":\"X\","
+                 "\"ts\":{},\"dur\":{},\"pid\":{},\"tid\":{}",
+                 e.name, e.start_us - this->epoch_us, e.end_us - e.start_us, pid,
+                 buffer->tid);
+      if (!e.detail.empty()) {
+        fmt::print(file, ",\"args\":{{\"detail\":\"{}\"}}", escape(e.detail));
+      }
+      fmt::print(file, "}}");
+    }
+    buffer->events.clear();
+  }
+  fmt::print(file, "\n]}}\n");
+
+  bool failed = std::ferror(file) != 0;
+  failed |= std::fclose(file) != 0;
+  if (failed) throw XwimError{"Failed writing trace {}", path};
+}
+
+}  // namespace xwim::trace
@@ -0,0 +1,130 @@
+#pragma once
+
+#include <chrono>
+#include <cstdint>
+#include <filesystem>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+namespace xwim::trace {
+
+/**
+ * Timeline tracing in Chrome trace-event format, for Perfetto or
+ * chrome://tracing.
+ *
+ * Spans go to the `Recorder` attached to the calling thread, into a buffer
+ * per thread without locking, and are written in one go by
+ * `Recorder::write`. If no recorder is attached a `Span` costs a single
+ * thread-local load.
+ */
+
+class Recorder;
+
+namespace detail {
+inline thread_local Recorder* current = nullptr;
+}
+
+// Recorder of the calling thread, nullptr if it is not tracing
+inline Recorder* current() { return detail::current; }
+
+inline bool enabled() { return current() != nullptr; }
+
+/**
+ * The spans of one traced run.
+ *
+ * Each run owns its recorder, so concurrent runs do not mix their spans.
+ */
+class Recorder {
+ private:
+  struct Buffer;
+
+  uint64_t id;
+  int64_t epoch_us;
+  std::mutex buffers_mutex;
+  // Owned here so they survive their threads until `write`
+  std::vector<std::unique_ptr<Buffer>> buffers;
+
+  Buffer& local_buffer();
+
+ public:
+  Recorder();
+  ~Recorder();
+
+  Recorder(const Recorder&) = delete;
+  Recorder& operator=(const Recorder&) = delete;
+
+  void record(const char* name, std::string detail, int64_t start_us,
+              int64_t end_us);
+
+  // Write all spans recorded so far to `path`, throws `XwimError` if writing
+  // fails. All threads recording spans must have finished.
+  void write(const std::filesystem::path& path);
+};
+
+/**
+ * Attaches `recorder` to the calling thread from construction to
+ * destruction, nullptr detaches. Threads working on behalf of a traced run
+ * attach to the recorder (`current()`) of the thread that started them.
+ */
+class Attach {
+ private:
+  Recorder* previous;
+
+ public:
+  explicit Attach(Recorder* recorder) : previous(detail::current) {
+    detail::current = recorder;
+  }
+
+  ~Attach() { detail::current = this->previous; }
+
+  Attach(const Attach&) = delete;
+  Attach& operator=(const Attach&) = delete;
+};
+
+inline int64_t now_us() {
+  return std::chrono::duration_cast<std::chrono::microseconds>(
+             std::chrono::steady_clock::now().time_since_epoch())
+      .count();
+}
+
+/**
+ * Records the time from construction to destruction as a span named `name`.
+ *
+ * `name` must outlive the trace, use string literals. `detail`, e.g. a path,
+ * is shown as argument of the span.
+ */
+class Span {
+ private:
+  const char* name;
+  std::string detail;
+  Recorder* recorder;
+  int64_t start_us = -1;
+
+ public:
+  explicit Span(const char* name) : name(name), recorder(current()) {
+    if (this->recorder) this->start_us = now_us();
+  }
+
+  template <typename Detail>
+  Span(const char* name, const Detail& detail)
+      : name(name), recorder(current()) {
+    if (this->recorder) {
+      this->detail = std::string{detail};
+      this->start_us = now_us();
+    }
+  }
+
+  ~Span() {
+    if (this->recorder) {
+      this->recorder->record(this->name, std::move(this->detail),
+                             this->start_us, now_us());
+    }
+  }
+
+  Span(const Span&) = delete;
+  Span& operator=(const Span&) = delete;
+};
+
+}  // namespace xwim::trace
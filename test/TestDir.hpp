@@ -0,0 +1,63 @@
+#pragma once
+
+#include "gtest/gtest.h"
+
+#include <unistd.h>
+
+#include <filesystem>
+#include <fstream>
+#include <iterator>
+#include <string>
+
+namespace xwim::test {
+
+/**
+ * Fixture running each test in a fresh working directory below the system
+ * temp directory. The directory is named after the test and the process, so
+ * test executables can run concurrently. It is removed and the previous
+ * working directory restored after the test.
+ *
+ * Fixtures preparing further files override `SetUp` and call
+ * `TestDir::SetUp()` first.
+ */
+class TestDir : public ::testing::Test {
+ protected:
+  std::filesystem::path dir;
+
+  void SetUp() override {
+    namespace fs = std::filesystem;
+    const auto* info = ::testing::UnitTest::GetInstance()->current_test_info();
+    this->dir = fs::temp_directory_path() /
+                (std::string{"xwim_"} + info->test_suite_name() + "_" +
+                 info->name() + "_" + std::to_string(getpid()));
+    fs::remove_all(this->dir);
+    fs::create_directories(this->dir);
+    this->cwd = fs::current_path();
+    fs::current_path(this->dir);
+  }
+
+  void TearDown() override {
+    namespace fs = std::filesystem;
+    fs::current_path(this->cwd);
+    fs::remove_all(this->dir);
+  }
+
+  // Write `content` to `path`, creating parent directories
+  static void write(const std::filesystem::path& path,
+                    const std::string& content) {
+    if (path.has_parent_path()) {
+      std::filesystem::create_directories(path.parent_path());
+    }
+    std::ofstream{path, std::ios::binary} << content;
+  }
+
+  static std::string read(const std::filesystem::path& path) {
+    std::ifstream in{path, std::ios::binary};
+    return {std::istreambuf_iterator<char>{in}, {}};
+  }
+
+ private:
+  std::filesystem::path cwd;
+};
+
+}  // namespace xwim::test
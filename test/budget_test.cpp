@@ -0,0 +1,91 @@
+#include "gtest/gtest.h"
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <optional>
+#include <thread>
+
+#include "util/Budget.hpp"
+
+using namespace std::chrono_literals;
+
+// Whether `admitted` stays false for a while, i.e. the acquiring thread waits
+static bool stays_blocked(const std::atomic<bool>& admitted) {
+  std::this_thread::sleep_for(50ms);
+  return !admitted;
+}
+
+// Whether `admitted` turns true within a few seconds
+static bool gets_admitted(const std::atomic<bool>& admitted) {
+  for (int i = 0; i < 500 && !admitted; i++) {
+    std::this_thread::sleep_for(10ms);
+  }
+  return admitted;
+}
+
+TEST(MemoryBudget, acquire_waits_for_release) {
+  using namespace xwim;
+
+  MemoryBudget budget{100};
+  std::optional<Reservation> first;
+  first.emplace(budget, 60);
+
+  std::atomic<bool> admitted{false};
+  std::thread second{[&] {
+    Reservation reservation{budget, 60};
+    admitted = true;
+  }};
+
+  EXPECT_TRUE(stays_blocked(admitted));
+  first.reset();
+  EXPECT_TRUE(gets_admitted(admitted));
+  second.join();
+
+  // Jobs that fit together run together
+  Reservation a{budget, 50};
+  Reservation b{budget, 50};
+}
+
+TEST(MemoryBudget, over_limit_runs_alone) {
+  using namespace xwim;
+
+  MemoryBudget budget{100};
+  std::optional<Reservation> small;
+  small.emplace(budget, 10);
+
+  std::atomic<bool> admitted{false};
+  std::atomic<bool> done{false};
+  std::thread large{[&] {
+    Reservation reservation{budget, 500};
+    admitted = true;
+    while (!done) std::this_thread::sleep_for(1ms);
+  }};
+
+  // Waits for the running job, then runs although it exceeds the limit
+  EXPECT_TRUE(stays_blocked(admitted));
+  small.reset();
+  EXPECT_TRUE(gets_admitted(admitted));
+
+  // Nothing else starts next to it
+  std::atomic<bool> next_admitted{false};
+  std::thread next{[&] {
+    Reservation reservation{budget, 1};
+    next_admitted = true;
+  }};
+  EXPECT_TRUE(stays_blocked(next_admitted));
+  done = true;
+  EXPECT_TRUE(gets_admitted(next_admitted));
+
+  large.join();
+  next.join();
+}
+
+TEST(MemoryBudget, zero_limit_never_blocks) {
+  using namespace xwim;
+
+  MemoryBudget budget{0};
+  Reservation a{budget, uint64_t{1} << 40};
+  Reservation b{budget, uint64_t{1} << 40};
+  ASSERT_EQ(budget.capacity(), 0u);
+}
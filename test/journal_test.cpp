@@ -0,0 +1,71 @@
+#include "gtest/gtest.h"
+
+#include <chrono>
+#include <filesystem>
+#include <optional>
+
+#include "TestDir.hpp"
+#include "archiver/Journal.hpp"
+#include "util/Common.hpp"
+
+namespace fs = std::filesystem;
+
+class JournalTest : public xwim::test::TestDir {
+ protected:
+  void SetUp() override {
+    TestDir::SetUp();
+    write("archive.tar.gz", "not really an archive");
+  }
+};
+
+TEST_F(JournalTest, save_load) {
+  using namespace xwim;
+
+  Journal journal = Journal::start("archive.tar.gz");
+  ASSERT_EQ(journal.archive_size, 21u);
+  ASSERT_EQ(journal.entries, 0u);
+  journal.entries = 1234;
+
+  fs::path path = Journal::file_name("archive.tar.gz");
+  journal.save(path);
+  ASSERT_FALSE(fs::exists(path.string() + ".tmp"));
+
+  std::optional<Journal> loaded = Journal::load(path);
+  ASSERT_TRUE(loaded.has_value());
+  ASSERT_TRUE(loaded->same_archive(journal));
+  ASSERT_EQ(loaded->archive_mtime_ns, journal.archive_mtime_ns);
+  ASSERT_EQ(loaded->entries, 1234u);
+}
+
+TEST_F(JournalTest, unreadable) {
+  using namespace xwim;
+
+  ASSERT_FALSE(Journal::load("missing").has_value());
+
+  write("garbage", "xwim-journal 1\narchive-size x\n");
+  ASSERT_FALSE(Journal::load("garbage").has_value());
+
+  ASSERT_THROW(Journal::start("missing.tar.gz"), XwimError);
+}
+
+TEST_F(JournalTest, changed_archive) {
+  using namespace xwim;
+
+  Journal journal = Journal::start("archive.tar.gz");
+
+  fs::last_write_time("archive.tar.gz",
+                      fs::last_write_time("archive.tar.gz") -
+                          std::chrono::seconds{10});
+  ASSERT_FALSE(Journal::start("archive.tar.gz").same_archive(journal));
+}
+
+TEST_F(JournalTest, ignores_trailing_fields) {
+  using namespace xwim;
+
+  // Journals of earlier versions also recorded a stream position
+  write("old", "xwim-journal 1\narchive-size 21\narchive-mtime 5\n"
+               "entries 7\nposition 1234\n");
+  std::optional<Journal> loaded = Journal::load("old");
+  ASSERT_TRUE(loaded.has_value());
+  ASSERT_EQ(loaded->entries, 7u);
+}
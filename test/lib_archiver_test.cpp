@@ -0,0 +1,569 @@
+#include "gtest/gtest.h"
+
+#include <archive.h>
+#include <archive_entry.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <zlib.h>
+
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <filesystem>
+#include <map>
+#include <random>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "Archiver.hpp"
+#include "TestDir.hpp"
+#include "Xwim.hpp"
+#include "archiver/Journal.hpp"
+#include "util/Hash.hpp"
+#include "util/Manifest.hpp"
+
+namespace fs = std::filesystem;
+
+using LibArchiverTest = xwim::test::TestDir;
+
+static void put_le(std::string& b, size_t at, uint64_t v, int n) {
+  for (int i = 0; i < n; i++) b[at + i] = static_cast<char>(v >> (8 * i));
+}
+
+static uint64_t get_le(const std::string& b, size_t at, int n) {
+  uint64_t v = 0;
+  for (int i = n - 1; i >= 0; i--) v = (v << 8) | static_cast<uint8_t>(b[at + i]);
+  return v;
+}
+
+// Make the first entry of the zip archive `data` claim `size` uncompressed
+// bytes in its central directory header, via a zip64 extra field
+static std::string claim_size(std::string data, uint64_t size) {
+  size_t cd = data.find("PK\x01\x02");
+  size_t name_len = get_le(data, cd + 28, 2);
+  size_t extra_len = get_le(data, cd + 30, 2);
+
+  std::string zip64{"\x01\x00\x08\x00", 4};
+  zip64 += std::string(8, '\0');
+  put_le(zip64, 4, size, 8);
+  data.insert(cd + 46 + name_len + extra_len, zip64);
+  put_le(data, cd + 24, 0xffffffff, 4);
+  put_le(data, cd + 30, extra_len + zip64.size(), 2);
+
+  size_t eocd = data.rfind("PK\x05\x06");
+  put_le(data, eocd + 12, get_le(data, eocd + 12, 4) + zip64.size(), 4);
+  return data;
+}
+
+// Write a gzip compressed tar stream holding only the header of a regular
+// file `name` that claims `size` bytes
+static void write_tar_header(const fs::path& path, const std::string& name,
+                             uint64_t size) {
+  std::string h(512, '\0');
+  h.replace(0, name.size(), name);
+  h.replace(100, 7, "0000644");
+  h.replace(108, 7, "0000000");
+  h.replace(116, 7, "0000000");
+  h[124] = '\x80';  // base-256 size
+  for (int i = 0; i < 8; i++) h[135 - i] = static_cast<char>(size >> (8 * i));
+  h.replace(136, 11, "00000000000");
+  h[156] = '0';
+  h.replace(257, 8, std::string{"ustar\0" "00", 8});
+
+  unsigned sum = 0;
+  h.replace(148, 8, "        ");
+  for (char c : h) sum += static_cast<uint8_t>(c);
+  char chksum[8];
+  std::snprintf(chksum, sizeof(chksum), "%06o", sum);
+  h.replace(148, 7, std::string{chksum, 7});
+
+  gzFile gz = gzopen(path.c_str(), "wb");
+  ASSERT_NE(gz, nullptr);
+  ASSERT_EQ(gzwrite(gz, h.data(), h.size()), 512);
+  ASSERT_EQ(gzclose(gz), Z_OK);
+}
+
+// An entry as written by `write_entries` and read by `read_entries`
+struct Entry {
+  std::string data;  // holes read as zeros
+  bool sized = true;  // size declared in the header
+  std::vector<std::pair<int64_t, int64_t>> extents;  // sparse data, if any
+};
+
+// Write `entries` with libarchive into a pax tar.gz, or a zip if `zip`
+static void write_entries(const fs::path& path,
+                          const std::map<std::string, Entry>& entries,
+                          bool zip) {
+  archive* a = archive_write_new();
+  if (zip) {
+    archive_write_set_format_zip(a);
+  } else {
+    archive_write_set_format_pax_restricted(a);
+    archive_write_add_filter_gzip(a);
+  }
+  ASSERT_EQ(archive_write_open_filename(a, path.c_str()), ARCHIVE_OK);
+
+  for (const auto& [name, e] : entries) {
+    archive_entry* entry = archive_entry_new();
+    archive_entry_set_pathname(entry, name.c_str());
+    archive_entry_set_filetype(entry, AE_IFREG);
+    archive_entry_set_perm(entry, 0644);
+    // Zip writes an entry without size with a data descriptor
+    if (e.sized) archive_entry_set_size(entry, e.data.size());
+    for (auto [offset, len] : e.extents) {
+      archive_entry_sparse_add_entry(entry, offset, len);
+    }
+    ASSERT_EQ(archive_write_header(a, entry), ARCHIVE_OK);
+    ASSERT_EQ(archive_write_data(a, e.data.data(), e.data.size()),
+              la_ssize_t(e.data.size()));
+    archive_entry_free(entry);
+  }
+
+  ASSERT_EQ(archive_write_close(a), ARCHIVE_OK);
+  archive_write_free(a);
+}
+
+// Read the regular file entries of the archive at `path` with libarchive
+static std::map<std::string, Entry> read_entries(const fs::path& path) {
+  std::map<std::string, Entry> entries;
+  archive* a = archive_read_new();
+  archive_read_support_format_all(a);
+  archive_read_support_filter_all(a);
+  EXPECT_EQ(archive_read_open_filename(a, path.c_str(), 10240), ARCHIVE_OK);
+
+  archive_entry* entry;
+  while (archive_read_next_header(a, &entry) == ARCHIVE_OK) {
+    Entry& e = entries[archive_entry_pathname(entry)];
+    e.sized = archive_entry_size_is_set(entry);
+    int64_t extent_offset;
+    int64_t extent_len;
+    archive_entry_sparse_reset(entry);
+    while (archive_entry_sparse_next(entry, &extent_offset, &extent_len) ==
+           ARCHIVE_OK) {
+      e.extents.push_back({extent_offset, extent_len});
+    }
+
+    const void* buff;
+    size_t len;
+    int64_t offset;
+    while (archive_read_data_block(a, &buff, &len, &offset) == ARCHIVE_OK) {
+      if (e.data.size() < size_t(offset)) e.data.resize(offset);
+      e.data.append(static_cast<const char*>(buff), len);
+    }
+    if (e.sized) e.data.resize(archive_entry_size(entry));
+  }
+
+  archive_read_free(a);
+  return entries;
+}
+
+TEST_F(LibArchiverTest, compress_extract_roundtrip) {
+  using namespace xwim;
+
+  write("in/a.txt", "hello");
+  write("in/sub/b.txt", std::string(100000, 'b'));
+
+  LibArchiver archiver;
+  archiver.compress({"in"}, "out.tar.gz");
+  archiver.extract("out.tar.gz", "x");
+
+  ASSERT_EQ(read("x/in/a.txt"), "hello");
+  ASSERT_EQ(read("x/in/sub/b.txt"),
+            std::string(100000, 'b'));
+}
+
+TEST_F(LibArchiverTest, extracts_multi_member_gzip) {
+  using namespace xwim;
+
+  write("in/a.txt", "hello");
+  write("in/sub/b.txt", std::string(100000, 'b'));
+  LibArchiver archiver;
+  archiver.compress({"in"}, "out.tar.gz");
+
+  std::string tar(1 << 20, '\0');
+  gzFile in = gzopen("out.tar.gz", "rb");
+  ASSERT_NE(in, nullptr);
+  tar.resize(gzread(in, tar.data(), tar.size()));
+  gzclose(in);
+
+  // The tar split across two members, as `cat a.gz b.gz` writes it
+  for (auto [part, mode] : {std::pair{tar.substr(0, 1536), "wb"},
+                            std::pair{tar.substr(1536), "ab"}}) {
+    gzFile gz = gzopen("out.tar.gz", mode);
+    ASSERT_NE(gz, nullptr);
+    ASSERT_EQ(gzwrite(gz, part.data(), part.size()), int(part.size()));
+    ASSERT_EQ(gzclose(gz), Z_OK);
+  }
+
+  archiver.extract("out.tar.gz", "x");
+  ASSERT_EQ(read("x/in/a.txt"), "hello");
+  ASSERT_EQ(read("x/in/sub/b.txt"), std::string(100000, 'b'));
+}
+
+TEST_F(LibArchiverTest, compress_uses_filter_of_extension) {
+  using namespace xwim;
+
+  write("in/a.txt", "hello");
+  write("in/sub/b.txt", std::string(100000, 'b'));
+
+  // libarchive's own extension lookup misses .tar.lz, .tar.Z and .tar.zst
+  const std::vector<std::pair<std::string, std::string>> magics{
+      {"out.tar.bz2", "BZh"},
+      {"out.tar.gz", "\x1f\x8b"},
+      {"out.tar.lz", "LZIP"},
+      {"out.tar.xz", "\xfd" "7zXZ"},
+      {"out.tar.Z", "\x1f\x9d"},
+      {"out.tar.zst", "\x28\xb5\x2f\xfd"},
+      {"out.zip", "PK\x03\x04"}};
+
+  LibArchiver archiver;
+  for (const auto& [archive, magic] : magics) {
+    SCOPED_TRACE(archive);
+    archiver.compress({"in"}, archive);
+    ASSERT_EQ(read(archive).substr(0, magic.size()), magic);
+
+    fs::path out = "x" + archive;
+    archiver.extract(archive, out);
+    ASSERT_EQ(read(out / "in/a.txt"), "hello");
+    ASSERT_EQ(read(out / "in/sub/b.txt"), std::string(100000, 'b'));
+  }
+}
+
+TEST_F(LibArchiverTest, compress_reports_write_errors) {
+  using namespace xwim;
+
+  // Small archives are buffered, the write error surfaces on close only
+  write("in/a.txt", "hello");
+  fs::create_symlink("/dev/full", "full.tar.gz");
+
+  LibArchiver archiver;
+  ASSERT_THROW(archiver.compress({"in"}, "full.tar.gz"),
+               XwimError);
+}
+
+TEST_F(LibArchiverTest, resume_skips_journaled_entries) {
+  using namespace xwim;
+
+  write("in/a.txt", "aaaa");
+  write("in/b.txt", "bbbb");
+
+  Options opts;
+  opts.ordering = Ordering::LEXICAL;  // in, in/a.txt, in/b.txt
+  LibArchiver{opts}.compress({"in"}, "out.tar.gz");
+  LibArchiver{opts}.extract("out.tar.gz", "x");
+
+  // Change the extracted files in a way the size and modification time
+  // check of `--resume` cannot see
+  for (const char* f : {"x/in/a.txt", "x/in/b.txt"}) {
+    auto mtime = fs::last_write_time(f);
+    write(f, "XXXX");
+    fs::last_write_time(f, mtime);
+  }
+
+  // An interrupted run finished the first two entries
+  Journal journal = Journal::start("out.tar.gz");
+  journal.entries = 2;
+  journal.save(fs::path{"x"} / Journal::file_name("out.tar.gz"));
+
+  opts.resume = true;
+  LibArchiver{opts}.extract("out.tar.gz", "x");
+
+  ASSERT_EQ(read("x/in/a.txt"), "XXXX");
+  ASSERT_EQ(read("x/in/b.txt"), "bbbb");
+  ASSERT_FALSE(fs::exists(fs::path{"x"} / Journal::file_name("out.tar.gz")));
+
+  // Without a journal, everything is extracted again
+  LibArchiver{opts}.extract("out.tar.gz", "x");
+  ASSERT_EQ(read("x/in/a.txt"), "aaaa");
+}
+
+TEST_F(LibArchiverTest, update_removes_temp_file_of_failed_entry) {
+  using namespace xwim;
+
+  write("in/a.txt", "aaaa");
+  write("in/b.txt", std::string(4 << 20, 'b'));
+
+  Options opts;
+  opts.ordering = Ordering::LEXICAL;  // in, in/a.txt, in/b.txt
+  LibArchiver{opts}.compress({"in"}, "out.tar.gz");
+  LibArchiver{opts}.extract("out.tar.gz", "x");
+  write("x/in/b.txt", "changed");
+
+  // The data of in/b.txt is cut off
+  std::string gz = read("out.tar.gz");
+  write("cut.tar.gz", gz.substr(0, gz.size() / 2));
+
+  opts.update = true;
+  ASSERT_THROW(LibArchiver{opts}.extract("cut.tar.gz", "x"), XwimError);
+
+  ASSERT_EQ(read("x/in/b.txt"), "changed");
+  size_t files = 0;
+  for (const auto& e : fs::directory_iterator("x/in")) {
+    ASSERT_TRUE(e.path().filename() == "a.txt" ||
+                e.path().filename() == "b.txt")
+        << e.path();
+    files++;
+  }
+  ASSERT_EQ(files, 2u);
+}
+
+TEST_F(LibArchiverTest, dedup_hardlinks_identical_files) {
+  using namespace xwim;
+
+  std::string data(100000, 'd');
+  std::string last = data;
+  last.back() = 'e';
+  write("in/a", data);
+  write("in/b", data);
+  write("in/c", last);
+
+  // Hardlinks share the modification time, give all files the same
+  auto mtime = fs::last_write_time("in/a");
+  mtime -= mtime.time_since_epoch() % std::chrono::seconds{1};
+  for (const char* f : {"in/a", "in/b", "in/c"}) fs::last_write_time(f, mtime);
+
+  Options opts;
+  opts.ordering = Ordering::LEXICAL;
+  LibArchiver{opts}.compress({"in"}, "out.tar.gz");
+
+  opts.dedup = Dedup::HARDLINK;
+  LibArchiver{opts}.extract("out.tar.gz", "x");
+
+  ASSERT_EQ(fs::hard_link_count("x/in/a"), 2u);
+  ASSERT_EQ(fs::hard_link_count("x/in/b"), 2u);
+  ASSERT_TRUE(fs::equivalent("x/in/a", "x/in/b"));
+  ASSERT_EQ(read("x/in/b"), data);
+
+  // Differs in the last byte only, written from where it differs
+  ASSERT_EQ(fs::hard_link_count("x/in/c"), 1u);
+  ASSERT_EQ(read("x/in/c"), last);
+
+  // No links without dedup
+  opts.dedup = Dedup::NONE;
+  LibArchiver{opts}.extract("out.tar.gz", "y");
+  ASSERT_EQ(fs::hard_link_count("y/in/a"), 1u);
+  ASSERT_EQ(fs::hard_link_count("y/in/b"), 1u);
+}
+
+TEST_F(LibArchiverTest, preflight_rejects_archive_larger_than_disk) {
+  using namespace xwim;
+
+  write("in/a.txt", "hello");
+  LibArchiver{}.compress({"in"}, "small.zip");
+  write("huge.zip", claim_size(read("small.zip"), uint64_t{1} << 62));
+
+  try {
+    LibArchiver{}.extract("huge.zip", "x");
+    FAIL() << "extracted an archive larger than the disk";
+  } catch (const XwimError& e) {
+    ASSERT_NE(std::string{e.what()}.find("Not enough space"),
+              std::string::npos)
+        << e.what();
+  }
+  ASSERT_FALSE(fs::exists("x"));
+
+  // Through the intent, which picks the output folder
+  Options opts;
+  opts.extract = true;
+  opts.paths = {"huge.zip"};
+  ASSERT_THROW(run(opts), XwimError);
+  ASSERT_FALSE(fs::exists("huge"));
+}
+
+TEST_F(LibArchiverTest, preallocate_reports_full_disk) {
+  using namespace xwim;
+
+  // Needs a file system that supports fallocate
+  int fd = open("probe", O_WRONLY | O_CREAT, 0644);
+  ASSERT_GE(fd, 0);
+  bool supported = fallocate(fd, FALLOC_FL_KEEP_SIZE, 0, 4096) == 0;
+  close(fd);
+  if (!supported) GTEST_SKIP() << "fallocate not supported";
+
+  uint64_t size = fs::space(".").available + (uint64_t{1} << 30);
+  write_tar_header("big.tar.gz", "big", size);
+
+  try {
+    LibArchiver{}.extract("big.tar.gz", "x");
+    FAIL() << "extracted more than the disk holds";
+  } catch (const XwimError& e) {
+    ASSERT_NE(std::string{e.what()}.find("Not enough space"),
+              std::string::npos)
+        << e.what();
+  }
+  ASSERT_FALSE(fs::exists("x/big"));
+}
+
+TEST_F(LibArchiverTest, preallocates_large_files) {
+  using namespace xwim;
+
+  std::string data(3 << 20, 'p');
+  write("in/large", data);
+  LibArchiver{}.compress({"in"}, "out.tar.gz");
+  LibArchiver{}.extract("out.tar.gz", "x");
+
+  ASSERT_EQ(read("x/in/large"), data);
+  struct stat st;
+  ASSERT_EQ(stat("x/in/large", &st), 0);
+  ASSERT_GE(st.st_blocks * 512, static_cast<int64_t>(data.size()));
+}
+
+// Digests of "hello" and 100000 times 'a' as printed by xxh128sum and
+// sha256sum
+static const char* hello_xxh3 = "b5e9c1ad071b3e7fc779cfaa5e523818";
+static const char* as_xxh3 = "819d5302938c790308f809ef04c54838";
+static const char* hello_sha256 =
+    "2cf24dba5fb0a30e26e83b2ac5b9e29e1b161e5c1fa7425e73043362938b9824";
+static const char* as_sha256 =
+    "6d1cf22d7cc09b085dfc25ee1a1f3ae0265804c607bc2074ad253bcc82fd81ee";
+
+TEST_F(LibArchiverTest, manifest_lines) {
+  using namespace xwim;
+
+  write("in/a.txt", "hello");
+  write("in/b.txt", std::string(100000, 'a'));
+
+  Options opts;
+  opts.ordering = Ordering::LEXICAL;
+  opts.threads = 1;
+
+  auto with_manifest = [&](HashAlgorithm algorithm, const Options& o,
+                           auto fn) {
+    Manifest manifest{"m", algorithm};
+    LibArchiver archiver{o};
+    archiver.set_manifest(&manifest);
+    fn(archiver);
+    manifest.close();
+    return read("m");
+  };
+
+  // Compressed files are listed by their path on disk
+  std::string xxh3 = std::string{hello_xxh3} + "  in/a.txt\n" + as_xxh3 +
+                     "  in/b.txt\n";
+  ASSERT_EQ(with_manifest(HashAlgorithm::XXH3, opts,
+                          [](auto& a) { a.compress({"in"}, "out.tar.gz"); }),
+            xxh3);
+
+  Options parallel = opts;
+  parallel.threads = 4;
+  ASSERT_EQ(with_manifest(HashAlgorithm::XXH3, parallel,
+                          [](auto& a) { a.compress({"in"}, "out.zip"); }),
+            xxh3);
+
+  // Extracted files, too
+  ASSERT_EQ(with_manifest(HashAlgorithm::XXH3, opts,
+                          [](auto& a) { a.extract("out.tar.gz", "x"); }),
+            std::string{hello_xxh3} + "  x/in/a.txt\n" + as_xxh3 +
+                "  x/in/b.txt\n");
+
+  // Converted entries never reach the disk, they are listed by name
+  ASSERT_EQ(with_manifest(HashAlgorithm::XXH3, opts,
+                          [](auto& a) {
+                            a.convert({"out.zip"}, "converted.tar.zst");
+                          }),
+            xxh3);
+
+  try {
+    Hasher{HashAlgorithm::SHA256};
+  } catch (const XwimError&) {
+    GTEST_SKIP() << "built without SHA-256 support";
+  }
+
+  ASSERT_EQ(with_manifest(HashAlgorithm::SHA256, opts,
+                          [](auto& a) { a.extract("out.zip", "y"); }),
+            std::string{hello_sha256} + "  y/in/a.txt\n" + as_sha256 +
+                "  y/in/b.txt\n");
+  ASSERT_EQ(with_manifest(HashAlgorithm::SHA256, opts,
+                          [](auto& a) {
+                            a.convert({"out.tar.gz"}, "converted.zip");
+                          }),
+            std::string{hello_sha256} + "  in/a.txt\n" + as_sha256 +
+                "  in/b.txt\n");
+}
+
+TEST_F(LibArchiverTest, convert_sparse_tar_gz) {
+  using namespace xwim;
+
+  Entry sparse;
+  sparse.data = std::string(4 << 20, '\0');
+  sparse.data.replace(0, 4, "head");
+  sparse.data.replace(3 << 20, 4, "tail");
+  sparse.extents = {{0, 4}, {3 << 20, 4}};
+  write_entries("in.tar.gz", {{"in/a.txt", {"hello", true, {}}}, {"in/sparse", sparse}},
+                false);
+  ASSERT_FALSE(read_entries("in.tar.gz")["in/sparse"].extents.empty());
+
+  LibArchiver{}.convert({"in.tar.gz"}, "out.tar.zst");
+
+  // Holes are written out as zeros
+  auto out = read_entries("out.tar.zst");
+  ASSERT_EQ(out.size(), 2u);
+  ASSERT_EQ(out["in/a.txt"].data, "hello");
+  ASSERT_EQ(out["in/sparse"].data.size(), sparse.data.size());
+  ASSERT_EQ(out["in/sparse"].data, sparse.data);
+}
+
+TEST_F(LibArchiverTest, convert_streamed_zip) {
+  using namespace xwim;
+
+  std::mt19937 gen{1};
+  Entry streamed;
+  streamed.data = std::string(3 << 20, '\0');
+  for (char& c : streamed.data) c = static_cast<char>(gen() % 16);
+  streamed.sized = false;
+  write_entries("in.zip", {{"in/a.txt", {"hello", true, {}}}, {"in/streamed", streamed}},
+                true);
+
+  // Without its end record, the archive is read from the local headers
+  // alone and the size is unknown up front
+  std::string zip = read("in.zip");
+  zip[zip.rfind("PK\x05\x06") + 3] = 0;
+  write("cut.zip", zip);
+  ASSERT_FALSE(read_entries("cut.zip")["in/streamed"].sized);
+
+  // Sizes are taken from the central directory
+  LibArchiver{}.convert({"in.zip"}, "out.tar.zst");
+  auto out = read_entries("out.tar.zst");
+  ASSERT_EQ(out.size(), 2u);
+  ASSERT_EQ(out["in/a.txt"].data, "hello");
+  ASSERT_EQ(out["in/streamed"].data, streamed.data);
+
+  // Without it, the data is held back up to the size of the pipe
+  LibArchiver{}.convert({"cut.zip"}, "cut.tar.zst");
+  ASSERT_EQ(read_entries("cut.tar.zst")["in/streamed"].data, streamed.data);
+
+  Options opts;
+  opts.memory_limit = 8 << 20;  // 1 MiB pipe
+  try {
+    LibArchiver{opts}.convert({"cut.zip"}, "small.tar.zst");
+    FAIL() << "converted an entry of unknown size beyond the limit";
+  } catch (const XwimError& e) {
+    ASSERT_NE(std::string{e.what()}.find("in/streamed"), std::string::npos)
+        << e.what();
+  }
+}
+
+TEST_F(LibArchiverTest, convert_reports_decoder_errors) {
+  using namespace xwim;
+
+  std::mt19937 gen{1};
+  std::map<std::string, Entry> entries;
+  for (int i = 0; i < 4; i++) {
+    Entry e;
+    e.data = std::string(1 << 20, '\0');
+    for (char& c : e.data) c = static_cast<char>(gen());
+    entries["in/" + std::to_string(i)] = e;
+  }
+  write_entries("in.tar.gz", entries, false);
+
+  // The decoder fails in the third entry, while the pipe is full
+  std::string gz = read("in.tar.gz");
+  write("cut.tar.gz", gz.substr(0, gz.size() * 5 / 8));
+
+  Options opts;
+  opts.memory_limit = 8 << 20;  // 1 MiB pipe
+  ASSERT_THROW(LibArchiver{opts}.convert({"cut.tar.gz"}, "out.tar.zst"),
+               XwimError);
+}
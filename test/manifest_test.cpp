@@ -0,0 +1,79 @@
+#include "gtest/gtest.h"
+
+#include <filesystem>
+#include <string>
+
+#include "TestDir.hpp"
+#include "util/Common.hpp"
+#include "util/Hash.hpp"
+#include "util/Manifest.hpp"
+
+namespace fs = std::filesystem;
+
+using ManifestTest = xwim::test::TestDir;
+
+TEST_F(ManifestTest, lines) {
+  using namespace xwim;
+
+  Manifest manifest{"m.xxh128", HashAlgorithm::XXH3};
+  manifest.add("00ff", "x/a.txt");
+  manifest.add("11ee", fs::current_path() / "x" / "b.txt");
+  manifest.add("22dd", "x/./c.txt");
+  manifest.close();
+
+  // Absolute paths are relative to the working directory
+  ASSERT_EQ(read("m.xxh128"),
+            "00ff  x/a.txt\n"
+            "11ee  x/b.txt\n"
+            "22dd  x/c.txt\n");
+}
+
+TEST_F(ManifestTest, escapes_like_coreutils) {
+  using namespace xwim;
+
+  Manifest manifest{"m.xxh128", HashAlgorithm::XXH3};
+  manifest.add("00ff", "back\\slash");
+  manifest.add("11ee", "new\nline");
+  manifest.add("22dd", "plain");
+  manifest.close();
+
+  ASSERT_EQ(read("m.xxh128"),
+            "\\00ff  back\\\\slash\n"
+            "\\11ee  new\\nline\n"
+            "22dd  plain\n");
+}
+
+TEST_F(ManifestTest, relocate) {
+  using namespace xwim;
+
+  Manifest manifest{"m.xxh128", HashAlgorithm::XXH3};
+  manifest.add("00ff", "keep/foo/a");
+  uint64_t start = manifest.end();
+  manifest.add("11ee", "out/foo/a");
+  manifest.add("22dd", "out/foo/sub/new\nline");
+  manifest.add("33cc", "out/other");
+  manifest.relocate(start, fs::current_path() / "out" / "foo", "out");
+  manifest.add("44bb", "later");
+  manifest.close();
+
+  ASSERT_EQ(read("m.xxh128"),
+            "00ff  keep/foo/a\n"
+            "11ee  out/a\n"
+            "\\22dd  out/sub/new\\nline\n"
+            "33cc  out/other\n"
+            "44bb  later\n");
+}
+
+TEST_F(ManifestTest, unsupported_hash_keeps_file) {
+  using namespace xwim;
+
+  try {
+    Hasher{HashAlgorithm::SHA256};
+    GTEST_SKIP() << "built with SHA-256 support";
+  } catch (const XwimError&) {
+  }
+
+  write("m.sha256", "previous manifest");
+  ASSERT_THROW((Manifest{"m.sha256", HashAlgorithm::SHA256}), XwimError);
+  ASSERT_EQ(read("m.sha256"), "previous manifest");
+}
@@ -0,0 +1,184 @@
+#include "gtest/gtest.h"
+
+#include <zlib.h>
+
+#include <cstdint>
+#include <initializer_list>
+#include <random>
+#include <string>
+
+#include "TestDir.hpp"
+#include "Xwim.hpp"
+#include "archiver/GzipReader.hpp"
+#include "archiver/Memory.hpp"
+#include "archiver/ZipWriter.hpp"
+
+static constexpr uint64_t MiB = 1 << 20;
+
+static std::string bytes(std::initializer_list<int> b) {
+  std::string s;
+  for (int c : b) s.push_back(static_cast<char>(c));
+  return s;
+}
+
+// Stream header and first block header as written by `xz -6` and `xz -9`
+static const std::string xz_stream =
+    bytes({0xfd, 0x37, 0x7a, 0x58, 0x5a, 0x00, 0x00, 0x04, 0xe6, 0xd6, 0xb4,
+           0x46, 0x04, 0xc0, 0x0a, 0x06, 0x21, 0x01});
+static const std::string xz_6 =
+    xz_stream +
+    bytes({0x16, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0xaa, 0x30, 0x8e, 0xa6});
+static const std::string xz_9 =
+    xz_stream +
+    bytes({0x1c, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0x63, 0xa0, 0xac, 0xb1});
+
+static const std::string zstd_magic = bytes({0x28, 0xb5, 0x2f, 0xfd});
+
+using MemoryTest = xwim::test::TestDir;
+
+TEST(Memory, xz_dictionary) {
+  using namespace xwim;
+
+  ASSERT_EQ(xz_dictionary(xz_6), 8 * MiB);
+  ASSERT_EQ(xz_dictionary(xz_9), 64 * MiB);
+
+  ASSERT_FALSE(xz_dictionary(xz_6.substr(0, 12)).has_value());
+  ASSERT_FALSE(xz_dictionary(xz_6.substr(0, 18)).has_value());
+  ASSERT_FALSE(xz_dictionary(bytes({0x5d, 0x00, 0x00, 0x80})).has_value());
+}
+
+TEST(Memory, lzip_dictionary) {
+  using namespace xwim;
+
+  // Coded size 0x17: 2^23, no fractions subtracted
+  ASSERT_EQ(lzip_dictionary(std::string{"LZIP"} + bytes({0x01, 0x17})),
+            8 * MiB);
+  // 0xb8: 2^24 - 5/16 * 2^24
+  ASSERT_EQ(lzip_dictionary(std::string{"LZIP"} + bytes({0x01, 0xb8})),
+            11 * MiB);
+  ASSERT_FALSE(lzip_dictionary("LZIP").has_value());
+}
+
+TEST(Memory, zstd_window) {
+  using namespace xwim;
+
+  // Single segment frame of `zstd` for 6 bytes: the window is the content
+  ASSERT_EQ(zstd_window(zstd_magic + bytes({0x24, 0x06, 0x31, 0x00})), 6u);
+  // Two byte content size is offset by 256
+  ASSERT_EQ(zstd_window(zstd_magic + bytes({0x60, 0x00, 0x01, 0x00})),
+            256u + 256u);
+
+  // Window descriptors of `zstd -19` and `zstd --long=27`, and a mantissa
+  ASSERT_EQ(zstd_window(zstd_magic + bytes({0x04, 0x68, 0x00, 0x00})),
+            8 * MiB);
+  ASSERT_EQ(zstd_window(zstd_magic + bytes({0x04, 0x88, 0x00, 0x00})),
+            128 * MiB);
+  ASSERT_EQ(zstd_window(zstd_magic + bytes({0x04, 0x6b, 0x00, 0x00})),
+            11 * MiB);
+
+  // Skippable frames before the first frame
+  std::string skippable =
+      bytes({0x50, 0x2a, 0x4d, 0x18, 0x03, 0x00, 0x00, 0x00, 'a', 'b', 'c'});
+  ASSERT_EQ(zstd_window(skippable + skippable + zstd_magic +
+                        bytes({0x04, 0x68, 0x00, 0x00})),
+            8 * MiB);
+
+  ASSERT_FALSE(zstd_window(zstd_magic + bytes({0x04})).has_value());
+  ASSERT_FALSE(zstd_window(zstd_magic + bytes({0x60, 0x00})).has_value());
+  ASSERT_FALSE(zstd_window(skippable).has_value());
+  ASSERT_FALSE(zstd_window("").has_value());
+}
+
+TEST(Memory, bzip2_memory) {
+  using namespace xwim;
+
+  for (int level = 1; level <= 9; level++) {
+    std::string head = "BZh" + std::to_string(level);
+    ASSERT_EQ(bzip2_memory(head), 100000u + 400000u * level) << head;
+  }
+
+  ASSERT_FALSE(bzip2_memory("BZh0").has_value());
+  ASSERT_FALSE(bzip2_memory("BZh").has_value());
+  ASSERT_FALSE(bzip2_memory("BZ").has_value());
+}
+
+TEST_F(MemoryTest, decoder_memory_of_unreadable_header) {
+  using namespace xwim;
+
+  write("9.tar.xz", xz_9);
+  write("6.tar.xz", xz_6);
+  write("cut.tar.xz", xz_6.substr(0, 13));
+
+  Options opts;
+  uint64_t xz9 = decoder_memory("9.tar.xz", opts);
+  uint64_t xz6 = decoder_memory("6.tar.xz", opts);
+  uint64_t cut = decoder_memory("cut.tar.xz", opts);
+
+  ASSERT_EQ(xz9 - xz6, 56 * MiB);
+  // The largest dictionary xwim writes, as for `xz -9`
+  ASSERT_EQ(cut, xz9);
+}
+
+// Append a gzip member of `data` to `path`
+static void gzip_member(const std::string& path, const std::string& data,
+                        const char* mode) {
+  gzFile gz = gzopen(path.c_str(), mode);
+  ASSERT_NE(gz, nullptr);
+  ASSERT_EQ(gzwrite(gz, data.data(), data.size()), int(data.size()));
+  ASSERT_EQ(gzclose(gz), Z_OK);
+}
+
+TEST_F(MemoryTest, gzip_memory_covers_output) {
+  using namespace xwim;
+
+  std::mt19937 gen{1};
+  std::string noise(MiB / 2, '\0');
+  for (char& c : noise) c = static_cast<char>(gen());
+  gzip_member("one.gz", noise + noise, "wb");
+  gzip_member("two.gz", noise, "wb");
+  gzip_member("two.gz", noise, "ab");
+
+  // Without libdeflate everything is streamed
+  uint64_t streaming = GzipReader::memory("one.gz", 0);
+  uint64_t one = GzipReader::memory("one.gz");
+  if (!GzipReader::accelerated()) {
+    ASSERT_EQ(one, streaming);
+    return;
+  }
+
+  // The whole output of a single member, next to the zlib buffers
+  ASSERT_EQ(one, streaming + MiB);
+  ASSERT_EQ(GzipReader::memory("one.gz", MiB - 1), streaming);
+  // The trailer of the last member does not cover the stream
+  ASSERT_EQ(GzipReader::memory("two.gz"), streaming);
+}
+
+TEST(Memory, buffer_sizes) {
+  using namespace xwim;
+
+  Options opts;
+  Buffers unlimited = buffer_sizes(opts);
+  ASSERT_EQ(unlimited.gzip_whole, 64 * MiB);
+  ASSERT_EQ(unlimited.convert_pipe, 16 * MiB);
+  ASSERT_EQ(unlimited.zip_window, 0u);
+
+  // Buffers shrink, but keep a usable minimum
+  opts.memory_limit = 4 * MiB;
+  Buffers small = buffer_sizes(opts);
+  ASSERT_EQ(small.gzip_whole, 2 * MiB);
+  ASSERT_EQ(small.convert_pipe, 1 * MiB);
+  ASSERT_EQ(small.zip_window, zip::chunk_memory);
+
+  opts.memory_limit = 1;
+  Buffers tiny = buffer_sizes(opts);
+  ASSERT_EQ(tiny.gzip_whole, 0u);
+  ASSERT_EQ(tiny.convert_pipe, 1 * MiB);
+  ASSERT_EQ(tiny.zip_window, zip::chunk_memory);
+
+  // Large limits do not grow buffers beyond their defaults
+  opts.memory_limit = uint64_t{64} << 30;
+  Buffers large = buffer_sizes(opts);
+  ASSERT_EQ(large.gzip_whole, 64 * MiB);
+  ASSERT_EQ(large.convert_pipe, 16 * MiB);
+  ASSERT_EQ(large.zip_window, uint64_t{32} << 30);
+}
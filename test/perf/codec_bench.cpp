@@ -0,0 +1,158 @@
+// Compares the deflate codecs xwim can be built with: stock zlib and
+// libdeflate. Only built if libdeflate is found, run with
+// `meson test --benchmark --suite perf`.
+//
+// Usage: codec_bench [MiB]
+//
+// Deflates and inflates text-like and incompressible data of the given size
+// (default 64) with both codecs and prints the throughput. Every stream is
+// inflated by the other codec, too; a mismatch fails the benchmark, so the
+// codecs stay interchangeable.
+#include <fmt/core.h>
+#include <libdeflate.h>
+#include <zlib.h>
+
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+#include <cstdlib>
+#include <functional>
+#include <random>
+#include <string>
+#include <utility>
+#include <vector>
+
+using Bytes = std::vector<unsigned char>;
+
+static Bytes text_like(size_t size, uint64_t seed) {
+  static const std::vector<std::string> words{
+      "archive", "entry",  "header", "stream", "block", "filter",
+      "format",  "buffer", "extent", "inode",  "path",  "data"};
+  std::mt19937_64 rng{seed};
+  Bytes data;
+  data.reserve(size + 16);
+  while (data.size() < size) {
+    const std::string& word = words[rng() % words.size()];
+    data.insert(data.end(), word.begin(), word.end());
+    data.push_back(rng() % 10 == 0 ? '\n' : ' ');
+  }
+  data.resize(size);
+  return data;
+}
+
+static Bytes random_bytes(size_t size, uint64_t seed) {
+  std::mt19937_64 rng{seed};
+  Bytes data(size);
+  for (auto& b : data) b = static_cast<unsigned char>(rng());
+  return data;
+}
+
+// Best of three runs in MiB/s
+static double throughput(size_t bytes, const std::function<void()>& run) {
+  double best = 0;
+  for (int i = 0; i < 3; i++) {
+    auto start = std::chrono::steady_clock::now();
+    run();
+    std::chrono::duration<double> took =
+        std::chrono::steady_clock::now() - start;
+    best = std::max(best, bytes / took.count() / (1 << 20));
+  }
+  return best;
+}
+
+static Bytes zlib_deflate(const Bytes& in) {
+  z_stream zs{};
+  deflateInit2(&zs, Z_DEFAULT_COMPRESSION, Z_DEFLATED, -MAX_WBITS, 8,
+               Z_DEFAULT_STRATEGY);
+  Bytes out(deflateBound(&zs, in.size()));
+  zs.next_in = const_cast<Bytef*>(in.data());
+  zs.avail_in = in.size();
+  zs.next_out = out.data();
+  zs.avail_out = out.size();
+  deflate(&zs, Z_FINISH);
+  out.resize(zs.total_out);
+  deflateEnd(&zs);
+  return out;
+}
+
+static Bytes zlib_inflate(const Bytes& in, size_t size) {
+  z_stream zs{};
+  inflateInit2(&zs, -MAX_WBITS);
+  Bytes out(size);
+  zs.next_in = const_cast<Bytef*>(in.data());
+  zs.avail_in = in.size();
+  zs.next_out = out.data();
+  zs.avail_out = out.size();
+  int r = inflate(&zs, Z_FINISH);
+  out.resize(r == Z_STREAM_END ? zs.total_out : 0);
+  inflateEnd(&zs);
+  return out;
+}
+
+static Bytes libdeflate_deflate(libdeflate_compressor* c, const Bytes& in) {
+  Bytes out(libdeflate_deflate_compress_bound(c, in.size()));
+  out.resize(libdeflate_deflate_compress(c, in.data(), in.size(), out.data(),
+                                         out.size()));
+  return out;
+}
+
+static Bytes libdeflate_inflate(libdeflate_decompressor* d, const Bytes& in,
+                                size_t size) {
+  Bytes out(size);
+  size_t n = 0;
+  if (libdeflate_deflate_decompress(d, in.data(), in.size(), out.data(),
+                                    out.size(), &n) != LIBDEFLATE_SUCCESS) {
+    n = 0;
+  }
+  out.resize(n);
+  return out;
+}
+
+int main(int argc, char** argv) {
+  size_t size = (argc > 1 ? std::strtoull(argv[1], nullptr, 10) : 64) << 20;
+
+  libdeflate_compressor* compressor = libdeflate_alloc_compressor(6);
+  libdeflate_decompressor* decompressor = libdeflate_alloc_decompressor();
+  bool ok = true;
+
+  fmt::print("{:<8} {:<11} {:>10} {:>10} {:>10} {:>8}\n", "data", "codec",
+             "deflate", "inflate", "crc32", "ratio");
+
+  for (const auto& [name, data] :
+       {std::pair{"text", text_like(size, 1)},
+        std::pair{"random", random_bytes(size, 2)}}) {
+    Bytes z = zlib_deflate(data);
+    Bytes l = libdeflate_deflate(compressor, data);
+
+    // Streams of either codec must decode to the input with both
+    ok &= zlib_inflate(z, size) == data && zlib_inflate(l, size) == data &&
+          libdeflate_inflate(decompressor, z, size) == data &&
+          libdeflate_inflate(decompressor, l, size) == data;
+
+    uLong zcrc = 0;
+    uint32_t lcrc = 0;
+    fmt::print(
+        "{:<8} {:<11} {:>6.0f}MB/s {:>6.0f}MB/s {:>6.0f}MB/s {:>8.3f}\n", name,
+        "zlib", throughput(size, [&] { z = zlib_deflate(data); }),
+        throughput(size, [&] { zlib_inflate(z, size); }),
+        throughput(size, [&] { zcrc = crc32(0, data.data(), data.size()); }),
+        double(z.size()) / size);
+    fmt::print(
+        "{:<8} {:<11} {:>6.0f}MB/s {:>6.0f}MB/s {:>6.0f}MB/s {:>8.3f}\n", name,
+        "libdeflate", throughput(size, [&] {
+          l = libdeflate_deflate(compressor, data);
+        }),
+        throughput(size,
+                   [&] { libdeflate_inflate(decompressor, l, size); }),
+        throughput(size,
+                   [&] { lcrc = libdeflate_crc32(0, data.data(), size); }),
+        double(l.size()) / size);
+    ok &= zcrc == lcrc;
+  }
+
+  libdeflate_free_compressor(compressor);
+  libdeflate_free_decompressor(decompressor);
+
+  if (!ok) fmt::print(stderr, "Codec outputs are not interchangeable\n");
+  return ok ? 0 : 1;
+}
@@ -0,0 +1,235 @@
+// Generates the deterministic perf corpus used by `meson test --suite perf`.
+//
+// Usage: corpus_gen <scale> <out-dir>
+//
+// <scale> shrinks the data of the large workloads. File counts, tree depth and
+// the size of the sparse file do not scale, so per-entry overhead is always
+// measured on 100k files and hole handling on 4 GiB.
+//
+// Creates one folder per workload in <out-dir> and archives each workload in
+// every supported format into <out-dir>/archives. <out-dir>/corpus.json
+// describes the result for run_perf.py. All content is derived from fixed
+// seeds, so the same scale always produces the same corpus.
+#include <fcntl.h>
+#include <fmt/core.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <cstdint>
+#include <cstdlib>
+#include <filesystem>
+#include <functional>
+#include <map>
+#include <random>
+#include <string>
+#include <vector>
+
+#include "Archiver.hpp"
+#include "Xwim.hpp"
+
+namespace fs = std::filesystem;
+
+// Bump when the workloads change, run_perf.py regenerates older corpora
+static const int corpus_version = 2;
+
+// One extension per `xwim::Format`
+static const std::vector<std::string> formats{
+    ".tar.bz2", ".tar.gz", ".tar.lz", ".tar.xz",
+    ".tar.Z",   ".tar.zst", ".zip"};
+
+static const std::vector<std::string> words{
+    "archive", "entry",  "header", "stream", "block", "filter",
+    "format",  "buffer", "extent", "inode",  "path",  "data",
+    "deflate", "window", "xwim",   "tar",    "zip",   "compress"};
+
+class Generator {
+ private:
+  std::mt19937_64 rng;
+  uint64_t bytes = 0;
+
+ public:
+  explicit Generator(uint64_t seed) : rng(seed) {}
+
+  uint64_t written() const { return this->bytes; }
+
+  uint64_t uniform(uint64_t from, uint64_t to) {
+    return std::uniform_int_distribution<uint64_t>{from, to}(this->rng);
+  }
+
+  // Text-like data, compresses well
+  std::string compressible(size_t size) {
+    std::string data;
+    data.reserve(size + 16);
+    while (data.size() < size) {
+      data += words[this->uniform(0, words.size() - 1)];
+      data += this->uniform(0, 9) == 0 ? '\n' : ' ';
+    }
+    data.resize(size);
+    return data;
+  }
+
+  // Random data, does not compress at all
+  std::string incompressible(size_t size) {
+    std::string data(size, '\0');
+    for (size_t i = 0; i < size; i += 8) {
+      uint64_t v = this->rng();
+      std::copy_n(reinterpret_cast<char*>(&v), std::min<size_t>(8, size - i),
+                  &data[i]);
+    }
+    return data;
+  }
+
+  void write(const fs::path& path, const std::string& data) {
+    fs::create_directories(path.parent_path());
+    int fd = open(path.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (fd < 0 || ::write(fd, data.data(), data.size()) !=
+                      static_cast<ssize_t>(data.size())) {
+      throw XwimError{"Failed writing {}", path};
+    }
+    close(fd);
+    this->bytes += data.size();
+  }
+
+  // Write `size` bytes in chunks, alternating compressible and incompressible
+  // chunks if `mixed`
+  void write_large(const fs::path& path, uint64_t size, bool mixed) {
+    fs::create_directories(path.parent_path());
+    int fd = open(path.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (fd < 0) throw XwimError{"Failed writing {}", path};
+
+    const uint64_t chunk = 1 << 20;
+    for (uint64_t off = 0, i = 0; off < size; off += chunk, i++) {
+      size_t n = std::min(chunk, size - off);
+      std::string data = mixed && i % 2 ? this->incompressible(n)
+                                        : this->compressible(n);
+      if (::write(fd, data.data(), n) != static_cast<ssize_t>(n)) {
+        throw XwimError{"Failed writing {}", path};
+      }
+    }
+    close(fd);
+    this->bytes += size;
+  }
+
+  // A file of `size` bytes with only a few data blocks, rest are holes
+  void write_sparse(const fs::path& path, uint64_t size) {
+    fs::create_directories(path.parent_path());
+    int fd = open(path.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (fd < 0 || ftruncate(fd, size) != 0) {
+      throw XwimError{"Failed writing {}", path};
+    }
+
+    const size_t block = 64 << 10;
+    for (uint64_t i = 0; i < 8; i++) {
+      uint64_t off = i * (size / 8);
+      std::string data = this->compressible(std::min<uint64_t>(block, size));
+      if (pwrite(fd, data.data(), data.size(), off) < 0) {
+        throw XwimError{"Failed writing {}", path};
+      }
+    }
+    close(fd);
+    this->bytes += size;
+  }
+};
+
+static uint64_t scaled(double scale, uint64_t n) {
+  return std::max<uint64_t>(1, static_cast<uint64_t>(n * scale));
+}
+
+int main(int argc, char** argv) {
+  if (argc != 3) {
+    fmt::print(stderr, "Usage: {} <scale> <out-dir>\n", argv[0]);
+    return EXIT_FAILURE;
+  }
+
+  double scale = std::stod(argv[1]);
+  fs::path out = fs::absolute(argv[2]);
+  fs::remove_all(out);
+  fs::create_directories(out / "archives");
+
+  using Workload = std::function<void(Generator&, const fs::path&)>;
+  std::map<std::string, Workload> workloads{
+      // Many tiny files, dominated by per-entry overhead
+      {"tiny",
+       [&](Generator& g, const fs::path& root) {
+         for (uint64_t i = 0; i < 100000; i++) {
+           g.write(root / fmt::format("{:03}", i % 100) / fmt::format("{}", i),
+                   g.compressible(g.uniform(0, 1024)));
+         }
+       }},
+      // A few huge files, dominated by codec throughput
+      {"huge",
+       [&](Generator& g, const fs::path& root) {
+         for (int i = 0; i < 3; i++) {
+           g.write_large(root / fmt::format("huge{}.bin", i),
+                         scaled(scale, 512ull << 20), i == 1);
+         }
+       }},
+      // A deeply nested tree, long paths
+      {"deep",
+       [&](Generator& g, const fs::path& root) {
+         fs::path p = root;
+         for (uint64_t i = 0; i < 512; i++) {
+           p /= "d";
+           g.write(p / "f", g.compressible(g.uniform(0, 4096)));
+         }
+       }},
+      // A sparse file, mostly holes
+      {"sparse",
+       [&](Generator& g, const fs::path& root) {
+         g.write_sparse(root / "sparse.img", 4ull << 30);
+       }},
+      // Compressible and incompressible files of varying size
+      {"mixed",
+       [&](Generator& g, const fs::path& root) {
+         for (uint64_t i = 0; i < 1000; i++) {
+           size_t size =
+               g.uniform(1 << 10, (1 << 10) + scaled(scale, 8 << 20));
+           g.write(root / fmt::format("m{}", i),
+                   i % 2 ? g.incompressible(size) : g.compressible(size));
+         }
+       }},
+  };
+
+  xwim::Options opts;
+  opts.ordering = xwim::Ordering::LEXICAL;
+
+  // Archive entries are named after the workload, not the corpus location
+  fs::current_path(out);
+
+  std::string workloads_json;
+  std::string archives_json;
+  uint64_t seed = 0;
+  for (auto& [name, generate] : workloads) {
+    fmt::print("Generating {}\n", name);
+    Generator g{++seed};
+    generate(g, name);
+    workloads_json += fmt::format("{}\n    \"{}\": {}",
+                                  workloads_json.empty() ? "" : ",", name,
+                                  g.written());
+
+    for (const auto& ext : formats) {
+      fs::path archive = fs::path{"archives"} / (name + ext);
+      fmt::print("Compressing {}\n", archive.string());
+      try {
+        xwim::LibArchiver{opts}.compress({name}, archive);
+      } catch (XwimError& e) {
+        // libarchive may be built without some filters
+        fmt::print(stderr, "Skipping {}: {}\n", archive.string(), e.what());
+        fs::remove(archive);
+        continue;
+      }
+      archives_json += fmt::format(
+          "{}\n    {{\"workload\": \"{}\", \"format\": \"{}\", \"path\": "
+          "\"{}\"}}",
+          archives_json.empty() ? "" : ",", name, ext, archive.string());
+    }
+  }
+
+  FILE* json = fopen("corpus.json", "w");
+  fmt::print(json,
+             "{{\n  \"version\": {},\n  \"scale\": {},\n"
+             "  \"workloads\": {{{}\n  }},\n"
+             "  \"archives\": [{}\n  ]\n}}\n",
+             corpus_version, scale, workloads_json, archives_json);
+  fclose(json);
+}
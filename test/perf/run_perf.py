@@ -0,0 +1,211 @@
+#!/usr/bin/env python3
+"""Perf regression gate for xwim.
+
+Generates the perf corpus with corpus_gen (if missing or generated at a
+different scale), times end-to-end `xwim` runs against it and compares the
+timings with a checked-in baseline.
+
+Timings depend on the machine, so the baseline does not hold seconds. Each
+session also times a fixed reference workload (zlib over generated text,
+through a temp file) and the baseline holds the ratio of each xwim timing to
+it. A timing regresses if it exceeds `ratio * reference * (1 + tolerance)`,
+where `reference` is this session's time for the reference workload. Each
+timing is the best of --repeat runs, which keeps noise on short runs below
+the tolerance. Runs shorter than MIN_SECONDS are repeated until they took
+that long in total, so the best of them is stable too.
+
+Ratios still shift between machines with different core counts, disks or
+compression libraries. Where the gate guards a CI machine, record the baseline
+there first with --update-baseline.
+
+Run with `meson test --suite perf`.
+"""
+
+import argparse
+import json
+import os
+import random
+import shutil
+import subprocess
+import sys
+import tempfile
+import time
+import zlib
+
+# Size of the reference workload, about a second of zlib on a current core
+REFERENCE_SIZE = 32 << 20
+
+# Must match `corpus_version` in corpus_gen.cpp
+CORPUS_VERSION = 2
+
+# Total time short runs are repeated for
+MIN_SECONDS = 1.0
+
+
+def load_corpus(corpus_gen, corpus_dir, scale):
+    corpus_json = os.path.join(corpus_dir, "corpus.json")
+    if os.path.exists(corpus_json):
+        with open(corpus_json) as f:
+            corpus = json.load(f)
+        if (corpus.get("version") == CORPUS_VERSION
+                and corpus["scale"] == scale):
+            return corpus
+
+    print(f"Generating corpus at scale {scale} in {corpus_dir}", flush=True)
+    subprocess.run([corpus_gen, str(scale), corpus_dir], check=True,
+                   stdout=subprocess.DEVNULL)
+    with open(corpus_json) as f:
+        return json.load(f)
+
+
+def best_of(repeat, cmd, cwd, cleanup):
+    best = None
+    total = 0.0
+    runs = 0
+    while runs < repeat or total < MIN_SECONDS:
+        cleanup()
+        # Writeback of earlier runs would otherwise land in this one
+        os.sync()
+        start = time.perf_counter()
+        subprocess.run(cmd, cwd=cwd, check=True, stdout=subprocess.DEVNULL)
+        elapsed = time.perf_counter() - start
+        best = elapsed if best is None else min(best, elapsed)
+        total += elapsed
+        runs += 1
+    cleanup()
+    return best
+
+
+def reference(repeat, tmp):
+    rng = random.Random(0)
+    letters = b"abcdefghijklmnopqrstuvwxyz"
+    words = [bytes(rng.choices(letters, k=rng.randint(2, 9)))
+             for _ in range(4096)]
+    data = b" ".join(rng.choices(words, k=REFERENCE_SIZE // 6))
+    path = os.path.join(tmp, "reference")
+
+    best = None
+    for _ in range(repeat):
+        start = time.perf_counter()
+        with open(path, "wb") as f:
+            f.write(data)
+        with open(path, "rb") as f:
+            zlib.compress(f.read(), 6)
+        elapsed = time.perf_counter() - start
+        best = elapsed if best is None else min(best, elapsed)
+    os.remove(path)
+    return best
+
+
+def measure(xwim, corpus_dir, corpus, repeat, tmp):
+    results = {}
+    out = os.path.join(tmp, "out")
+
+    def clean_out():
+        if os.path.isdir(out):
+            shutil.rmtree(out)
+        elif os.path.exists(out):
+            os.remove(out)
+
+    for a in corpus["archives"]:
+        name = a["workload"] + a["format"]
+        archive = os.path.join(corpus_dir, a["path"])
+
+        results[f"extract/{name}"] = best_of(
+            repeat, [xwim, "-x", archive, "-o", out], corpus_dir, clean_out)
+        results[f"test/{name}"] = best_of(
+            repeat, [xwim, "-t", archive], corpus_dir, lambda: None)
+
+        # Relative input so the archive does not depend on the corpus location
+        out_archive = out + a["format"]
+        results[f"compress/{name}"] = best_of(
+            repeat, [xwim, "-c", a["workload"], "-o", out_archive],
+            corpus_dir, lambda: os.path.exists(out_archive)
+            and os.remove(out_archive))
+
+        print(f"{name}: extract {results[f'extract/{name}']:.3f}s, "
+              f"test {results[f'test/{name}']:.3f}s, "
+              f"compress {results[f'compress/{name}']:.3f}s", flush=True)
+
+    return results
+
+
+def compare(results, ratios, ref, tolerance):
+    regressions = []
+    for key, seconds in sorted(results.items()):
+        ratio = ratios.get(key)
+        if ratio is None:
+            print(f"NEW  {key}: {seconds:.3f}s")
+            continue
+
+        expected = ratio * ref
+        limit = expected * (1 + tolerance)
+        status = "FAIL" if seconds > limit else "OK  "
+        print(f"{status} {key}: {seconds:.3f}s "
+              f"(expected {expected:.3f}s, limit {limit:.3f}s)")
+        if seconds > limit:
+            regressions.append(key)
+
+    for key in sorted(set(ratios) - set(results)):
+        print(f"MISS {key}: in baseline but not measured")
+
+    return regressions
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__.splitlines()[0])
+    parser.add_argument("--xwim", required=True)
+    parser.add_argument("--corpus-gen", required=True)
+    parser.add_argument("--corpus", required=True)
+    parser.add_argument("--baseline", required=True)
+    parser.add_argument("--tolerance", type=float)
+    parser.add_argument("--repeat", type=int, default=3)
+    parser.add_argument("--update-baseline", action="store_true")
+    args = parser.parse_args()
+
+    with open(args.baseline) as f:
+        baseline = json.load(f)
+
+    scale = float(os.environ.get("XWIM_PERF_SCALE", baseline["scale"]))
+    tolerance = args.tolerance
+    if tolerance is None:
+        tolerance = float(os.environ.get("XWIM_PERF_TOLERANCE",
+                                         baseline["tolerance"]))
+
+    xwim = os.path.abspath(args.xwim)
+    corpus_dir = os.path.abspath(args.corpus)
+    corpus = load_corpus(os.path.abspath(args.corpus_gen), corpus_dir, scale)
+
+    with tempfile.TemporaryDirectory(prefix="xwim-perf-") as tmp:
+        ref = reference(args.repeat, tmp)
+        print(f"reference: {ref:.3f}s", flush=True)
+        results = measure(xwim, corpus_dir, corpus, args.repeat, tmp)
+
+    if args.update_baseline:
+        baseline["scale"] = scale
+        # Informational only, comparisons use this session's reference time
+        baseline["reference_seconds"] = round(ref, 4)
+        baseline["ratios"] = {k: round(v / ref, 4)
+                              for k, v in sorted(results.items())}
+        baseline.pop("seconds", None)
+        baseline.pop("slack", None)
+        with open(args.baseline, "w") as f:
+            json.dump(baseline, f, indent=2)
+            f.write("\n")
+        print(f"Updated {args.baseline}")
+        return 0
+
+    if scale != baseline["scale"]:
+        print(f"Scale {scale} differs from baseline scale {baseline['scale']}, "
+              "not comparing")
+        return 0
+
+    regressions = compare(results, baseline["ratios"], ref, tolerance)
+    if regressions:
+        print(f"{len(regressions)} perf regression(s): {', '.join(regressions)}")
+        return 1
+    return 0
+
+
+if __name__ == "__main__":
+    sys.exit(main())
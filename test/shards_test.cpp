@@ -0,0 +1,95 @@
+#include "gtest/gtest.h"
+
+#include <algorithm>
+#include <cstdint>
+#include <filesystem>
+#include <set>
+#include <string>
+#include <vector>
+
+#include "Shards.hpp"
+#include "TestDir.hpp"
+
+namespace fs = std::filesystem;
+
+// A tree of files of different sizes and an empty directory
+class ShardsTest : public xwim::test::TestDir {
+ protected:
+  void SetUp() override {
+    TestDir::SetUp();
+    write("in/a/1", std::string(100000, 'x'));
+    write("in/a/2", std::string(60000, 'x'));
+    write("in/b/3", std::string(50000, 'x'));
+    write("in/b/c/4", std::string(40000, 'x'));
+    write("in/5", std::string(10000, 'x'));
+    fs::create_directories("in/empty");
+  }
+};
+
+TEST_F(ShardsTest, plan_balances_sizes) {
+  auto shards = xwim::plan_shards({"in"}, 3);
+  ASSERT_EQ(shards.size(), 3u);
+
+  // Largest first onto the smallest shard: 100k | 60k + 10k | 50k + 40k
+  std::vector<uintmax_t> loads;
+  std::multiset<fs::path> files;
+  for (const auto& shard : shards) {
+    uintmax_t load = 0;
+    for (const fs::path& p : shard) {
+      if (fs::is_regular_file(p)) {
+        load += fs::file_size(p);
+        files.insert(p);
+      }
+    }
+    loads.push_back(load);
+  }
+  std::sort(loads.begin(), loads.end());
+  ASSERT_EQ(loads, (std::vector<uintmax_t>{70000, 90000, 100000}));
+
+  // Every file is in exactly one shard
+  ASSERT_EQ(files, (std::multiset<fs::path>{"in/a/1", "in/a/2", "in/b/3",
+                                            "in/b/c/4", "in/5"}));
+}
+
+TEST_F(ShardsTest, plan_includes_parents) {
+  // A trailing slash names the same folder
+  for (const char* in : {"in", "in/"}) {
+    SCOPED_TRACE(in);
+    auto shards = xwim::plan_shards({in}, 3);
+
+    for (const auto& shard : shards) {
+      ASSERT_EQ(shard.count("in"), 1u);
+      for (const fs::path& p : shard) {
+        for (fs::path parent = p.parent_path(); !parent.empty();
+             parent = parent.parent_path()) {
+          ASSERT_EQ(shard.count(parent), 1u) << parent << " of " << p;
+        }
+      }
+    }
+
+    ASSERT_EQ(shards[0].count("in/empty"), 1u);
+    for (size_t i = 1; i < shards.size(); i++) {
+      ASSERT_EQ(shards[i].count("in/empty"), 0u);
+    }
+  }
+}
+
+TEST_F(ShardsTest, plan_no_more_shards_than_files) {
+  ASSERT_EQ(xwim::plan_shards({"in"}, 10).size(), 5u);
+  ASSERT_EQ(xwim::plan_shards({"in/a/1"}, 4).size(), 1u);
+  ASSERT_EQ(xwim::plan_shards({"in"}, 0).size(), 1u);
+}
+
+TEST_F(ShardsTest, shard_list) {
+  fs::path archive = "out.tar.zst";
+  ASSERT_EQ(xwim::shard_path(archive, 7), "out.007.tar.zst");
+  ASSERT_EQ(xwim::shard_list_path(archive), "out.tar.zst.shards");
+  ASSERT_TRUE(xwim::is_shard_list("out.tar.zst.shards"));
+
+  xwim::write_shard_list(xwim::shard_list_path(archive),
+                         {xwim::shard_path(archive, 0),
+                          xwim::shard_path(archive, 1)});
+  ASSERT_EQ(xwim::read_shard_list(fs::current_path() / "out.tar.zst.shards"),
+            (std::vector<fs::path>{fs::current_path() / "out.000.tar.zst",
+                                   fs::current_path() / "out.001.tar.zst"}));
+}
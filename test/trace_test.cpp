@@ -0,0 +1,62 @@
+#include "gtest/gtest.h"
+
+#include <string>
+#include <thread>
+
+#include "TestDir.hpp"
+#include "Xwim.hpp"
+#include "util/Common.hpp"
+#include "util/Parallel.hpp"
+#include "util/Trace.hpp"
+
+using TraceTest = xwim::test::TestDir;
+
+// Record spans named `name` on the calling thread and workers it starts
+static void traced_work(xwim::trace::Recorder& recorder, const char* name) {
+  xwim::trace::Attach attach{&recorder};
+  xwim::trace::Span span{name};
+  xwim::parallel_for(8, 4, [&](size_t) { xwim::trace::Span inner{name}; });
+}
+
+TEST_F(TraceTest, recorders_are_independent) {
+  using namespace xwim;
+
+  ASSERT_FALSE(trace::enabled());
+
+  trace::Recorder first;
+  trace::Recorder second;
+  std::thread a{[&] { traced_work(first, "first"); }};
+  std::thread b{[&] { traced_work(second, "second"); }};
+  a.join();
+  b.join();
+
+  // Not attached outside of `traced_work`
+  ASSERT_FALSE(trace::enabled());
+
+  first.write("first.json");
+  second.write("second.json");
+  std::string first_trace = read("first.json");
+  std::string second_trace = read("second.json");
+
+  ASSERT_NE(first_trace.find("\"first\""), std::string::npos);
+  ASSERT_EQ(first_trace.find("\"second\""), std::string::npos);
+  ASSERT_NE(second_trace.find("\"second\""), std::string::npos);
+  ASSERT_EQ(second_trace.find("\"first\""), std::string::npos);
+}
+
+TEST_F(TraceTest, failed_trace_keeps_run_error) {
+  using namespace xwim;
+
+  Options opts;
+  opts.extract = true;
+  opts.paths = {"/foo/bar.txt"};
+  opts.trace = "/nonexistent/xwim/trace.json";
+
+  try {
+    run(opts);
+    FAIL() << "run did not throw";
+  } catch (const XwimError& e) {
+    ASSERT_EQ(std::string{e.what()}.find("trace"), std::string::npos)
+        << e.what();
+  }
+}
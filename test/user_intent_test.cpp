@@ -0,0 +1,331 @@
+#include <gtest/gtest-death-test.h>
+#include "gtest/gtest.h"
+#include <sys/stat.h>
+
+#include <chrono>
+#include <filesystem>
+#include <fstream>
+#include <iterator>
+#include <map>
+#include <random>
+#include <string>
+
+#include "Archiver.hpp"
+#include "TestDir.hpp"
+#include "UserIntent.hpp"
+#include "Xwim.hpp"
+
+namespace fs = std::filesystem;
+
+// Intents executed end to end in a fresh working directory
+using UserIntentRun = xwim::test::TestDir;
+
+// `size` bytes that do not compress, deflate stores them as they are
+static std::string incompressible(size_t size, unsigned seed) {
+  std::mt19937 gen{seed};
+  std::string data(size, '\0');
+  for (char& c : data) c = static_cast<char>(gen());
+  return data;
+}
+
+// Inode of `path`, a file replaced by an update gets a new one
+static ino_t inode(const fs::path& path) {
+  struct stat st;
+  if (stat(path.c_str(), &st) != 0) return 0;
+  return st.st_ino;
+}
+
+// Content of the files below `root` by relative path, folders map to "/"
+static std::map<fs::path, std::string> tree(const fs::path& root) {
+  std::map<fs::path, std::string> entries;
+  for (const auto& e : fs::recursive_directory_iterator(root)) {
+    fs::path rel = e.path().lexically_relative(root);
+    std::ifstream in{e.path(), std::ios::binary};
+    entries[rel] = e.is_directory()
+                       ? "/"
+                       : std::string{std::istreambuf_iterator<char>{in}, {}};
+  }
+  return entries;
+}
+
+TEST(UserIntent, explicit_compress_single) {
+  using namespace xwim;
+
+  Options opts;
+  opts.compress = true;
+  opts.paths = {"/foo/bar"};
+
+  auto intent = make_intent(opts);
+  ASSERT_TRUE(dynamic_cast<CompressSingleIntent*>(intent.get()));
+}
+
+TEST(UserIntent, compress_many_requires_out) {
+  using namespace xwim;
+
+  Options opts;
+  opts.compress = true;
+  opts.paths = {"/foo/bar", "/foo/baz"};
+
+  ASSERT_THROW(make_intent(opts), XwimError);
+
+  opts.out = "/foo/out.tar.gz";
+  auto intent = make_intent(opts);
+  ASSERT_TRUE(dynamic_cast<CompressManyIntent*>(intent.get()));
+}
+
+TEST(UserIntent, infer_extract) {
+  using namespace xwim;
+
+  Options opts;
+  opts.paths = {"/foo/bar.tar.gz", "/foo/baz.zip"};
+
+  auto intent = make_intent(opts);
+  ASSERT_TRUE(dynamic_cast<ExtractIntent*>(intent.get()));
+}
+
+TEST(UserIntent, infer_compress) {
+  using namespace xwim;
+
+  Options opts;
+  opts.paths = {"/foo/bar"};
+
+  auto intent = make_intent(opts);
+  ASSERT_TRUE(dynamic_cast<CompressSingleIntent*>(intent.get()));
+}
+
+TEST(UserIntent, extract_unknown_format) {
+  using namespace xwim;
+
+  Options opts;
+  opts.extract = true;
+  opts.paths = {"/foo/bar.txt"};
+
+  ASSERT_THROW(make_intent(opts), XwimError);
+}
+
+TEST(UserIntent, no_input) {
+  using namespace xwim;
+
+  Options opts;
+  ASSERT_THROW(make_intent(opts), XwimError);
+}
+
+TEST(UserIntent, explicit_test) {
+  using namespace xwim;
+
+  Options opts;
+  opts.test = true;
+  opts.paths = {"/foo/bar.tar.gz", "/foo/baz.zip"};
+
+  auto intent = make_intent(opts);
+  ASSERT_TRUE(dynamic_cast<TestIntent*>(intent.get()));
+
+  opts.extract = true;
+  ASSERT_THROW(make_intent(opts), XwimError);
+}
+
+TEST(UserIntent, infer_extract_shard_list) {
+  using namespace xwim;
+
+  Options opts;
+  opts.paths = {"/foo/out.tar.zst.shards"};
+
+  auto intent = make_intent(opts);
+  ASSERT_TRUE(dynamic_cast<ExtractIntent*>(intent.get()));
+}
+
+TEST(UserIntent, explicit_convert) {
+  using namespace xwim;
+
+  Options opts;
+  opts.convert = true;
+  opts.paths = {"/foo/bar.zip"};
+  ASSERT_THROW(make_intent(opts), XwimError);  // no out archive
+
+  opts.out = "/foo/bar.tar.zst";
+  auto intent = make_intent(opts);
+  ASSERT_TRUE(dynamic_cast<ConvertIntent*>(intent.get()));
+
+  opts.compress = true;
+  ASSERT_THROW(make_intent(opts), XwimError);
+}
+
+TEST_F(UserIntentRun, test_reports_damaged_archives) {
+  using namespace xwim;
+
+  std::string last;
+  for (unsigned i = 0; i < 6; i++) {
+    last = incompressible(65536, i);
+    write("in/" + std::to_string(i), last);
+  }
+
+  Options opts;
+  opts.threads = 1;
+  LibArchiver{opts}.compress({"in"}, "intact.zip");
+  LibArchiver{opts}.compress({"in"}, "intact.tar.gz");
+
+  // Flip a data byte of the last entry, its CRC no longer matches
+  std::string zip = read("intact.zip");
+  size_t at = zip.find(last.substr(0, 64));
+  ASSERT_NE(at, std::string::npos);
+  zip[at + 1000] ^= 1;
+  write("damaged.zip", zip);
+
+  // Cut off the gzip trailer (CRC32 and ISIZE)
+  std::string gz = read("intact.tar.gz");
+  write("truncated.tar.gz", gz.substr(0, gz.size() - 8));
+
+  // Entries of the zip are tested in concurrent ranges
+  opts.test = true;
+  opts.threads = 4;
+  opts.paths = {"damaged.zip", "intact.zip", "intact.tar.gz",
+                "truncated.tar.gz"};
+  Result result = run(opts);
+
+  ASSERT_FALSE(result.ok());
+  ASSERT_EQ(result.verified.size(), 4u);
+  for (const Verification& v : result.verified) {
+    if (v.archive == "intact.zip" || v.archive == "intact.tar.gz") {
+      ASSERT_TRUE(v.ok()) << v.archive << ": " << v.error.value();
+    } else {
+      ASSERT_FALSE(v.ok()) << v.archive;
+    }
+  }
+  ASSERT_NE(result.verified[0].error->find("CRC"), std::string::npos)
+      << result.verified[0].error.value();
+  ASSERT_NE(result.verified[3].error->find("Truncated"), std::string::npos)
+      << result.verified[3].error.value();
+
+  opts.paths = {"intact.zip", "intact.tar.gz"};
+  ASSERT_TRUE(run(opts).ok());
+}
+
+TEST_F(UserIntentRun, manifest_paths_follow_flattening) {
+  using namespace xwim;
+
+  // xxh128sum of "hello"
+  const std::string hello = "b5e9c1ad071b3e7fc779cfaa5e523818";
+
+  write("foo/a.txt", "hello");
+  write("bar/b.txt", "hello");
+  write("c.txt", "hello");
+  write("d.txt", "hello");
+  LibArchiver{}.compress({"foo"}, "foo.tar.gz");
+  LibArchiver{}.compress({"bar"}, "bar.zip");
+  LibArchiver{}.compress({"c.txt", "d.txt"}, "loose.tar.gz");
+  for (const char* p : {"foo", "bar", "c.txt", "d.txt"}) fs::remove_all(p);
+
+  // foo/ and bar/ are flattened, loose/ holds both files
+  Options opts;
+  opts.extract = true;
+  opts.paths = {"foo.tar.gz", "bar.zip", "loose.tar.gz"};
+  opts.manifest = "m.xxh128";
+  run(opts);
+
+  ASSERT_EQ(read("m.xxh128"), hello + "  bar/b.txt\n" +
+                                  hello + "  foo/a.txt\n" +
+                                  hello + "  loose/c.txt\n" +
+                                  hello + "  loose/d.txt\n");
+  ASSERT_EQ(read("foo/a.txt"), "hello");
+  ASSERT_EQ(read("bar/b.txt"), "hello");
+  ASSERT_EQ(read("loose/d.txt"), "hello");
+}
+
+TEST_F(UserIntentRun, update_keeps_flattened_layout) {
+  using namespace xwim;
+
+  write("foo/same.txt", "same");
+  write("foo/touched.txt", "touched");
+  write("foo/sub/changed.txt", "archived");
+  LibArchiver{}.compress({"foo"}, "foo.tar.gz");
+  LibArchiver{}.compress({"foo"}, "foo.zip");
+  fs::remove_all("foo");
+
+  for (const char* archive : {"foo.tar.gz", "foo.zip"}) {
+    SCOPED_TRACE(archive);
+    fs::remove_all("foo");
+
+    // foo/ is flattened
+    Options opts;
+    opts.extract = true;
+    opts.paths = {archive};
+    run(opts);
+    ASSERT_EQ(read("foo/same.txt"), "same");
+
+    // Same size, newer modification time
+    write("foo/sub/changed.txt", "modified");
+    for (const char* f : {"foo/touched.txt", "foo/sub/changed.txt"}) {
+      fs::last_write_time(f, fs::last_write_time(f) + std::chrono::hours{1});
+    }
+    ino_t same = inode("foo/same.txt");
+    ino_t touched = inode("foo/touched.txt");
+    ino_t changed = inode("foo/sub/changed.txt");
+
+    opts.update = true;
+    run(opts);
+    ASSERT_FALSE(fs::exists("foo/foo"));
+    ASSERT_EQ(inode("foo/same.txt"), same);
+    ASSERT_NE(inode("foo/touched.txt"), touched);
+    ASSERT_NE(inode("foo/sub/changed.txt"), changed);
+    ASSERT_EQ(read("foo/touched.txt"), "touched");
+    ASSERT_EQ(read("foo/sub/changed.txt"), "archived");
+
+    // With `update_content`, files with identical data are kept
+    write("foo/sub/changed.txt", "modified");
+    for (const char* f : {"foo/touched.txt", "foo/sub/changed.txt"}) {
+      fs::last_write_time(f, fs::last_write_time(f) + std::chrono::hours{1});
+    }
+    touched = inode("foo/touched.txt");
+    changed = inode("foo/sub/changed.txt");
+
+    opts.update_content = true;
+    run(opts);
+    ASSERT_FALSE(fs::exists("foo/foo"));
+    ASSERT_EQ(inode("foo/same.txt"), same);
+    ASSERT_EQ(inode("foo/touched.txt"), touched);
+    ASSERT_NE(inode("foo/sub/changed.txt"), changed);
+    ASSERT_EQ(read("foo/sub/changed.txt"), "archived");
+
+    for (const auto& e : fs::recursive_directory_iterator("foo")) {
+      ASSERT_EQ(e.path().filename().string().find(".xwim"), std::string::npos)
+          << e.path();
+    }
+  }
+}
+
+TEST_F(UserIntentRun, shards_round_trip) {
+  using namespace xwim;
+
+  for (const char* in : {"data", "data/"}) {
+    SCOPED_TRACE(in);
+    for (const char* p : {"data", "orig", "data.tar.gz.shards"}) {
+      fs::remove_all(p);
+    }
+
+    for (unsigned i = 0; i < 7; i++) {
+      write("data/" + std::to_string(i % 3) + "/" + std::to_string(i),
+            incompressible(4096 * (i + 1), i));
+    }
+    write("data/top.txt", "top");
+    fs::create_directories("data/empty");
+    fs::create_directories("data/1/empty");
+
+    Options opts;
+    opts.compress = true;
+    opts.shards = 3;
+    opts.paths = {in};
+    opts.out = "data.tar.gz";
+    Result compressed = run(opts);
+    ASSERT_EQ(compressed.outputs.size(), 4u);  // and the shard list
+    fs::rename("data", "orig");
+
+    // Every shard has the root folder, the extraction is flattened into data/
+    Options extract;
+    extract.extract = true;
+    extract.paths = {"data.tar.gz.shards"};
+    run(extract);
+    ASSERT_EQ(tree("data"), tree("orig"));
+
+    for (const fs::path& shard : compressed.outputs) fs::remove(shard);
+  }
+}
@@ -88,3 +88,166 @@ TEST(UserOpt, output_defaults_to_nullopt) {
   UserOpt uo = UserOpt{2, args};
   ASSERT_FALSE(uo.out);
 }
+
+TEST(UserOpt, ordering) {
+  using namespace xwim;
+
+  // clang-format off
+  char* args[] = {
+    const_cast<char*>("xwim"),
+    const_cast<char*>("--order"),
+    const_cast<char*>("lexical"),
+    const_cast<char*>("/foo/bar"),
+    nullptr};
+  // clang-format on
+
+  UserOpt uo = UserOpt{4, args};
+  ASSERT_EQ(uo.ordering, Ordering::LEXICAL);
+}
+
+TEST(UserOpt, ordering_defaults_to_disk) {
+  using namespace xwim;
+
+  // clang-format off
+  char* args[] = {
+    const_cast<char*>("xwim"),
+    const_cast<char*>("/foo/bar"),
+    nullptr};
+  // clang-format on
+
+  UserOpt uo = UserOpt{2, args};
+  ASSERT_EQ(uo.ordering, Ordering::DISK);
+}
+
+TEST(UserOpt, test_with_threads) {
+  using namespace xwim;
+
+  // clang-format off
+  char* args[] = {
+    const_cast<char*>("xwim"),
+    const_cast<char*>("-t"),
+    const_cast<char*>("-j"),
+    const_cast<char*>("4"),
+    const_cast<char*>("/foo/bar.zip"),
+    nullptr};
+  // clang-format on
+
+  UserOpt uo = UserOpt{5, args};
+  ASSERT_TRUE(uo.wants_test());
+  ASSERT_EQ(uo.threads, 4u);
+}
+
+TEST(UserOpt, trace) {
+  using namespace xwim;
+
+  // clang-format off
+  char* args[] = {
+    const_cast<char*>("xwim"),
+    const_cast<char*>("--trace"),
+    const_cast<char*>("/tmp/trace.json"),
+    const_cast<char*>("/foo/bar.zip"),
+    nullptr};
+  // clang-format on
+
+  UserOpt uo = UserOpt{4, args};
+  ASSERT_EQ(uo.trace, std::filesystem::path{"/tmp/trace.json"});
+}
+
+TEST(UserOpt, resume) {
+  using namespace xwim;
+
+  // clang-format off
+  char* args[] = {
+    const_cast<char*>("xwim"),
+    const_cast<char*>("--resume"),
+    const_cast<char*>("/foo/bar.zip"),
+    nullptr};
+  // clang-format on
+
+  UserOpt uo = UserOpt{3, args};
+  ASSERT_TRUE(uo.resume);
+}
+
+TEST(UserOpt, update_content_implies_update) {
+  using namespace xwim;
+
+  // clang-format off
+  char* args[] = {
+    const_cast<char*>("xwim"),
+    const_cast<char*>("--update-content"),
+    const_cast<char*>("/foo/bar.zip"),
+    nullptr};
+  // clang-format on
+
+  UserOpt uo = UserOpt{3, args};
+  ASSERT_TRUE(uo.update);
+  ASSERT_TRUE(uo.update_content);
+}
+
+TEST(UserOpt, shards) {
+  using namespace xwim;
+
+  // clang-format off
+  char* args[] = {
+    const_cast<char*>("xwim"),
+    const_cast<char*>("--shards"),
+    const_cast<char*>("8"),
+    const_cast<char*>("-o"),
+    const_cast<char*>("/foo/out.tar.zst"),
+    const_cast<char*>("/foo/bar"),
+    nullptr};
+  // clang-format on
+
+  UserOpt uo = UserOpt{6, args};
+  ASSERT_EQ(uo.shards, 8u);
+}
+
+TEST(UserOpt, convert) {
+  using namespace xwim;
+
+  // clang-format off
+  char* args[] = {
+    const_cast<char*>("xwim"),
+    const_cast<char*>("--convert"),
+    const_cast<char*>("-o"),
+    const_cast<char*>("/foo/bar.tar.zst"),
+    const_cast<char*>("/foo/bar.zip"),
+    nullptr};
+  // clang-format on
+
+  UserOpt uo = UserOpt{5, args};
+  ASSERT_TRUE(uo.wants_convert());
+  ASSERT_FALSE(uo.wants_compress());
+}
+
+TEST(UserOpt, dedup) {
+  using namespace xwim;
+
+  // clang-format off
+  char* args[] = {
+    const_cast<char*>("xwim"),
+    const_cast<char*>("--dedup"),
+    const_cast<char*>("hardlink"),
+    const_cast<char*>("/foo/bar.tar.gz"),
+    nullptr};
+  // clang-format on
+
+  UserOpt uo = UserOpt{4, args};
+  ASSERT_EQ(uo.dedup, Dedup::HARDLINK);
+}
+
+TEST(UserOpt, memory_limit) {
+  using namespace xwim;
+
+  // clang-format off
+  char* args[] = {
+    const_cast<char*>("xwim"),
+    const_cast<char*>("--memory-limit"),
+    const_cast<char*>("512M"),
+    const_cast<char*>("/foo/bar.tar.xz"),
+    nullptr};
+  // clang-format on
+
+  UserOpt uo = UserOpt{4, args};
+  ASSERT_EQ(uo.memory_limit, uint64_t{512} << 20);
+}
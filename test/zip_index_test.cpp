@@ -0,0 +1,118 @@
+#include "gtest/gtest.h"
+
+#include <archive.h>
+#include <archive_entry.h>
+
+#include <cstdint>
+#include <filesystem>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "TestDir.hpp"
+#include "archiver/ZipIndex.hpp"
+
+namespace fs = std::filesystem;
+
+using ZipIndexTest = xwim::test::TestDir;
+
+// Write a zip archive of regular files with libarchive
+static void write_zip(const fs::path& path,
+                      const std::vector<std::pair<std::string, std::string>>&
+                          files) {
+  archive* a = archive_write_new();
+  archive_write_set_format_zip(a);
+  ASSERT_EQ(archive_write_open_filename(a, path.c_str()), ARCHIVE_OK);
+
+  for (const auto& [name, content] : files) {
+    archive_entry* entry = archive_entry_new();
+    archive_entry_set_pathname(entry, name.c_str());
+    archive_entry_set_filetype(entry, AE_IFREG);
+    archive_entry_set_perm(entry, 0644);
+    archive_entry_set_size(entry, content.size());
+    ASSERT_EQ(archive_write_header(a, entry), ARCHIVE_OK);
+    archive_write_data(a, content.data(), content.size());
+    archive_entry_free(entry);
+  }
+
+  ASSERT_EQ(archive_write_close(a), ARCHIVE_OK);
+  archive_write_free(a);
+}
+
+static void put_le(std::string& b, uint64_t v, int n) {
+  for (int i = 0; i < n; i++) b.push_back(static_cast<char>(v >> (8 * i)));
+}
+
+TEST_F(ZipIndexTest, read_central_directory) {
+  fs::path zip = "small.zip";
+  write_zip(zip, {{"a.txt", "hello"}, {"dir/b.txt", std::string(5000, 'b')}});
+
+  auto entries = xwim::zip::read_central_directory(zip);
+
+  ASSERT_TRUE(entries.has_value());
+  ASSERT_EQ(entries->size(), 2u);
+  ASSERT_EQ(entries->at(0).name, "a.txt");
+  ASSERT_EQ(entries->at(0).uncompressed_size, 5u);
+  ASSERT_EQ(entries->at(0).local_header_offset, 0u);
+  ASSERT_EQ(entries->at(1).name, "dir/b.txt");
+  ASSERT_EQ(entries->at(1).uncompressed_size, 5000u);
+  ASSERT_GT(entries->at(1).local_header_offset, 0u);
+}
+
+TEST_F(ZipIndexTest, truncated_central_directory) {
+  fs::path zip = "truncated.zip";
+  write_zip(zip, {{"a.txt", "hello"}, {"b.txt", "world"}});
+  std::string data = read(zip);
+
+  size_t eocd = data.rfind("PK\x05\x06");
+  ASSERT_NE(eocd, std::string::npos);
+
+  // End the central directory in the middle of the second header
+  uint64_t cd_size = 0;
+  for (int i = 3; i >= 0; i--) {
+    cd_size = (cd_size << 8) | static_cast<uint8_t>(data[eocd + 12 + i]);
+  }
+  std::string cut;
+  put_le(cut, cd_size - 20, 4);
+  cut = data.substr(0, eocd + 12) + cut + data.substr(eocd + 16);
+  write(zip, cut);
+  ASSERT_FALSE(xwim::zip::read_central_directory(zip).has_value());
+
+  // Claim more entries than the central directory holds
+  std::string more = data;
+  more[eocd + 10] = 3;
+  write(zip, more);
+  ASSERT_FALSE(xwim::zip::read_central_directory(zip).has_value());
+}
+
+TEST_F(ZipIndexTest, zip64_entry_count_out_of_range) {
+  // An empty central directory whose zip64 end record claims 2^64-1 entries
+  std::string data;
+  put_le(data, 0x06064b50, 4);  // zip64 end of central directory
+  put_le(data, 44, 8);
+  put_le(data, 45, 2);
+  put_le(data, 45, 2);
+  put_le(data, 0, 4);
+  put_le(data, 0, 4);
+  put_le(data, UINT64_MAX, 8);  // entries on this disk
+  put_le(data, UINT64_MAX, 8);  // entries
+  put_le(data, 0, 8);           // size
+  put_le(data, 0, 8);           // offset
+  put_le(data, 0x07064b50, 4);  // zip64 locator
+  put_le(data, 0, 4);
+  put_le(data, 0, 8);
+  put_le(data, 1, 4);
+  put_le(data, 0x06054b50, 4);  // end of central directory
+  put_le(data, 0, 4);
+  put_le(data, 0xffff, 2);
+  put_le(data, 0xffff, 2);
+  put_le(data, 0xffffffff, 4);
+  put_le(data, 0xffffffff, 4);
+  put_le(data, 0, 2);
+
+  fs::path zip = "zip64.zip";
+  write(zip, data);
+  auto entries = xwim::zip::read_central_directory(zip);
+
+  ASSERT_FALSE(entries.has_value());
+}
@@ -0,0 +1,138 @@
+#include "gtest/gtest.h"
+
+#include <archive.h>
+#include <archive_entry.h>
+#include <zlib.h>
+
+#include <algorithm>
+#include <cstdint>
+#include <filesystem>
+#include <map>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "TestDir.hpp"
+#include "archiver/ZipIndex.hpp"
+#include "archiver/ZipWriter.hpp"
+
+namespace fs = std::filesystem;
+
+// A tree of a file spanning several chunks, an empty file, a symlink and an
+// empty directory
+class ZipWriterTest : public xwim::test::TestDir {
+ protected:
+  std::string large;
+
+  void SetUp() override {
+    TestDir::SetUp();
+
+    // Compressible, but not trivially, so matches cross chunk boundaries
+    uint32_t state = 1;
+    while (this->large.size() < 2 * xwim::zip::chunk_size + 12345) {
+      state = state * 1103515245 + 12345;
+      this->large += "word" + std::to_string((state >> 16) % 1000) + ' ';
+    }
+
+    fs::create_directories("in/empty_dir");
+    write("in/large.txt", this->large);
+    write("in/empty.txt", "");
+    fs::create_symlink("large.txt", "in/link");
+  }
+
+  // Entries of `in` as `LibArchiver::compress` collects them
+  static std::vector<std::shared_ptr<archive_entry>> read_entries(
+      const fs::path& in) {
+    std::vector<std::shared_ptr<archive_entry>> entries;
+    archive* reader = archive_read_disk_new();
+    archive_read_disk_set_standard_lookup(reader);
+    EXPECT_EQ(archive_read_disk_open(reader, in.c_str()), ARCHIVE_OK);
+
+    archive_entry* entry = archive_entry_new();
+    while (archive_read_next_header2(reader, entry) == ARCHIVE_OK) {
+      entries.emplace_back(archive_entry_clone(entry), archive_entry_free);
+      archive_entry_clear(entry);
+      archive_read_disk_descend(reader);
+    }
+    archive_entry_free(entry);
+    archive_read_free(reader);
+    return entries;
+  }
+};
+
+TEST_F(ZipWriterTest, read_back) {
+  auto entries = read_entries("in");
+  xwim::zip::write_parallel("out.zip", entries, 4, nullptr);
+
+  // libarchive checks the CRC of each entry while reading its data
+  std::map<std::string, std::string> files;
+  std::map<std::string, std::string> links;
+  std::vector<std::string> dirs;
+
+  archive* reader = archive_read_new();
+  archive_read_support_format_zip(reader);
+  ASSERT_EQ(archive_read_open_filename(reader, "out.zip", 1 << 16), ARCHIVE_OK);
+  archive_entry* entry;
+  int r;
+  while ((r = archive_read_next_header(reader, &entry)) == ARCHIVE_OK) {
+    std::string name = archive_entry_pathname(entry);
+    switch (archive_entry_filetype(entry)) {
+      case AE_IFDIR:
+        dirs.push_back(name);
+        break;
+      case AE_IFLNK:
+        links[name] = archive_entry_symlink(entry);
+        break;
+      default: {
+        std::string data;
+        char buff[65536];
+        la_ssize_t len;
+        while ((len = archive_read_data(reader, buff, sizeof(buff))) > 0) {
+          data.append(buff, len);
+        }
+        ASSERT_EQ(len, 0) << archive_error_string(reader);
+        files[name] = data;
+      }
+    }
+  }
+  ASSERT_EQ(r, ARCHIVE_EOF) << archive_error_string(reader);
+  archive_read_free(reader);
+
+  ASSERT_EQ(files.size(), 2u);
+  ASSERT_EQ(files["in/large.txt"], this->large);
+  ASSERT_EQ(files["in/empty.txt"], "");
+  ASSERT_EQ(links["in/link"], "large.txt");
+  ASSERT_NE(std::find(dirs.begin(), dirs.end(), "in/empty_dir/"), dirs.end());
+
+  // The local header of the file spanning several chunks is patched with the
+  // combined CRC in the end
+  auto central = xwim::zip::read_central_directory("out.zip");
+  ASSERT_TRUE(central.has_value());
+  std::string zip = read("out.zip");
+  auto e = std::find_if(central->begin(), central->end(), [](const auto& e) {
+    return e.name == "in/large.txt";
+  });
+  ASSERT_NE(e, central->end());
+  const char* local = zip.data() + e->local_header_offset;
+  uint32_t crc = 0;
+  for (int i = 3; i >= 0; i--) crc = (crc << 8) | uint8_t(local[14 + i]);
+  ASSERT_EQ(crc, crc32(0, reinterpret_cast<const Bytef*>(large.data()),
+                       large.size()));
+}
+
+TEST_F(ZipWriterTest, independent_of_workers) {
+  auto entries = read_entries("in");
+
+  xwim::zip::write_parallel("1.zip", entries, 1, nullptr);
+  xwim::zip::write_parallel("3.zip", entries, 3, nullptr);
+  xwim::zip::write_parallel("8.zip", entries, 8, nullptr);
+  // One chunk in flight at a time
+  xwim::zip::write_parallel("window.zip", entries, 8, nullptr,
+                            xwim::zip::chunk_memory);
+
+  std::string expected = read("1.zip");
+  ASSERT_FALSE(expected.empty());
+  ASSERT_EQ(read("3.zip"), expected);
+  ASSERT_EQ(read("8.zip"), expected);
+  ASSERT_EQ(read("window.zip"), expected);
+}